@@ -0,0 +1,149 @@
+#include "batch.h"
+#include "cycle.h"
+#include "parallel.h"
+#include "rle.h"
+#include <algorithm>
+#include <chrono>
+
+// Steps run between two checks of the time limit.
+static const uint64_t STEPS_PER_CHECK = 1 << 20;
+// Batch output is handed to the stream in pieces of about this size.
+static const size_t OUTPUT_CHUNK = 1 << 16;
+
+static bool canMove(const Tm &tm, const Id &id) { return tm.match(id) >= 0; }
+
+static bool canMove(const Tm &tm, const RleId &id) { return id.match(tm) >= 0; }
+
+// Runs id without tracing, letting run(tm, id, n) execute up to n steps at a
+// time between checks of the limits.
+template <class I, class Run>
+static RunResult runLimited(const Tm &tm, I id, Run run,
+                            const RunLimits &limits) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto timedOut = [&]() {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return limits.timeout && elapsed.count() >= limits.timeout.value();
+    };
+    uint64_t step = 0;
+    bool halted = false;
+    while (step < limits.maxSteps && !timedOut()) {
+        const auto chunk = std::min(limits.maxSteps - step, STEPS_PER_CHECK);
+        const auto done = run(tm, id, chunk);
+        step += done;
+        if (done < chunk) {
+            halted = true;
+            break;
+        }
+    }
+    if (!halted && canMove(tm, id))
+        return {RunResult::Limit, "", id.state(), step};
+    return {RunResult::Halted, id.contents(0), id.state(), step};
+}
+
+RunResult runSteps(const Tm &tm, Id id,
+                   const std::function<uint64_t(Id &, uint64_t)> &run,
+                   const RunLimits &limits) {
+    return runLimited(
+        tm, std::move(id),
+        [&run](const Tm &, Id &id, uint64_t n) { return run(id, n); }, limits);
+}
+
+RunResult runInput(const Tm &tm, const string &input,
+                   const RunLimits &limits) {
+    if (!tm.validate(input))
+        return {RunResult::Illegal, "", tm.initialState(), 0};
+    if (limits.macro)
+        return runLimited(tm, RleId(tm, input), runMacro, limits);
+    return runId(tm, tm.initialId(input), limits);
+}
+
+RunResult runId(const Tm &tm, Id id, const RunLimits &limits) {
+    if (limits.jit)
+        return runLimited(
+            tm, std::move(id),
+            [&limits](const Tm &, Id &id, uint64_t n) {
+                return limits.jit->run(id, n);
+            },
+            limits);
+    if (limits.detectCycles) {
+        CycleDetector cycles(tm, id);
+        // A detected cycle ends the run as if it had halted.
+        const auto res = runLimited(
+            tm, std::move(id),
+            [&cycles](const Tm &, Id &id, uint64_t n) {
+                uint64_t done = 0;
+                while (done < n && !cycles.found() && cycles.step(id))
+                    ++done;
+                return done;
+            },
+            limits);
+        if (cycles.found())
+            return {RunResult::Cycle, "", cycles.cycleState(),
+                    cycles.cycleStart(), cycles.cycleLength()};
+        return res;
+    }
+    return runLimited(
+        tm, std::move(id),
+        [](const Tm &tm, Id &id, uint64_t n) { return tm.run(id, n); },
+        limits);
+}
+
+// Appends one tab-separated line: tape-0 contents, state, steps, and one of
+// accept/reject (halted in a final/non-final state), limit or illegal. A
+// cycle is reported as its state and step of entry, "cycle" and its length.
+void formatResult(const Tm &tm, const RunResult &res, string &out) {
+    if (res.outcome == RunResult::Illegal) {
+        out.append("\t\t0\tillegal\n");
+        return;
+    }
+    if (res.outcome == RunResult::Cycle) {
+        out.push_back('\t');
+        out.append(tm.stateName(res.state));
+        out.push_back('\t');
+        out.append(std::to_string(res.steps));
+        out.append("\tcycle\t");
+        out.append(std::to_string(res.cycleLength));
+        out.push_back('\n');
+        return;
+    }
+    out.append(res.contents);
+    out.push_back('\t');
+    out.append(tm.stateName(res.state));
+    out.push_back('\t');
+    out.append(std::to_string(res.steps));
+    out.append(res.outcome == RunResult::Limit ? "\tlimit\n"
+               : tm.isFinal(res.state)         ? "\taccept\n"
+                                               : "\treject\n");
+}
+
+// Runs tm on every line of in, writing one result line per input to out.
+// With more than one thread the inputs are handed to a ParallelRunner.
+void runBatch(const Tm &tm, std::istream &in, std::ostream &out,
+              const RunLimits &limits, unsigned threads) {
+    string buf;
+    buf.reserve(2 * OUTPUT_CHUNK);
+    const auto next = [&in](string &line) {
+        if (!std::getline(in, line))
+            return false;
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        return true;
+    };
+    const auto emit = [&](const RunResult &res) {
+        formatResult(tm, res, buf);
+        if (buf.size() >= OUTPUT_CHUNK) {
+            out.write(buf.data(), buf.size());
+            buf.clear();
+        }
+    };
+    if (threads > 1) {
+        ParallelRunner(tm, limits, threads).run(next, emit);
+    } else {
+        string line;
+        while (next(line))
+            emit(runInput(tm, line, limits));
+    }
+    out.write(buf.data(), buf.size());
+    out.flush();
+}
@@ -0,0 +1,44 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_BATCH_H
+#define _FLA_BATCH_H
+#include "jit.h"
+#include "tm.h"
+#include <functional>
+#include <istream>
+#include <ostream>
+
+struct RunLimits {
+    uint64_t maxSteps = UINT64_MAX;
+    optional<double> timeout;
+    bool macro = false;
+    bool detectCycles = false;
+    // Distinct configurations a nondeterministic search may visit.
+    uint64_t maxConfigs = UINT64_MAX;
+    // Runs on the compiled machine if set.
+    std::shared_ptr<const JitMachine> jit;
+};
+
+struct RunResult {
+    // Limit: stopped by maxSteps or timeout before halting.
+    // Cycle: enters a cycle of cycleLength steps at step steps, in state.
+    enum { Halted, Limit, Illegal, Cycle } outcome;
+    string contents;
+    StateIdx state;
+    uint64_t steps;
+    uint64_t cycleLength = 0;
+};
+
+// Runs id within the limits, letting run(id, n) execute up to n steps at a
+// time between checks of them. run returns the number of steps executed,
+// which is less than n only if the machine has halted.
+RunResult runSteps(const Tm &, Id,
+                   const std::function<uint64_t(Id &, uint64_t)> &run,
+                   const RunLimits &);
+RunResult runInput(const Tm &, const string &, const RunLimits &);
+// Runs id as runInput runs the initial Id, except in macro mode, which
+// starts from the input itself.
+RunResult runId(const Tm &, Id, const RunLimits &);
+void formatResult(const Tm &, const RunResult &, string &);
+void runBatch(const Tm &, std::istream &, std::ostream &, const RunLimits &,
+              unsigned threads = 1);
+#endif
@@ -0,0 +1,97 @@
+// Rule matching benchmark: runs synthetic machines with 8 and 16 tapes,
+// too wide for a transition table and with many wildcard rules per state,
+// and times the packed rule matcher against its scalar form.
+#include "match.h"
+#include "parser.h"
+#include "tm.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+static const string symbols = "abcdefgh_";
+static const size_t states = 4, rules = 48;
+
+static uint32_t lcg(uint32_t &seed) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+// Rules read about a third of the tapes each. The last rule of every state
+// is all wildcards, so the machine never halts.
+static string synthetic(uint32_t tapes) {
+    uint32_t seed = tapes;
+    string res = "#Q = {";
+    for (size_t i = 0; i < states; ++i)
+        res += (i ? ",s" : "s") + std::to_string(i);
+    res += ",halt}\n#S = {a,b,c,d,e,f,g,h}\n#G = {a,b,c,d,e,f,g,h,_}\n"
+           "#q0 = s0\n#B = _\n#F = {halt}\n#N = " +
+           std::to_string(tapes) + "\n";
+    for (size_t s = 0; s < states; ++s) {
+        for (size_t k = 0; k < rules; ++k) {
+            string get, put, dirs;
+            for (uint32_t i = 0; i < tapes; ++i) {
+                const bool any = k + 1 == rules || lcg(seed) % 3;
+                get += any ? '*' : symbols[lcg(seed) % symbols.size()];
+                put += symbols[lcg(seed) % symbols.size()];
+                dirs += "lrr*"[lcg(seed) % 4];
+            }
+            res += "s" + std::to_string(s) + ' ' + get + ' ' + put + ' ' +
+                   dirs + " s" + std::to_string(lcg(seed) % states) + '\n';
+        }
+    }
+    return res;
+}
+
+int main(int argc, char **argv) {
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 3;
+    for (uint32_t tapes : {8, 16}) {
+        const auto parsed = parseTm(synthetic(tapes));
+        if (parsed.isL()) {
+            std::cerr << (string)parsed.getL() << std::endl;
+            return 1;
+        }
+        const auto &tm = parsed.getR();
+        const uint64_t steps = 2000000;
+        double best = 0;
+        for (int i = 0; i < rounds; ++i) {
+            auto id = tm.initialId("abcdefgh");
+            const auto start = std::chrono::steady_clock::now();
+            tm.run(id, steps);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            best = std::max(best, steps / elapsed.count());
+        }
+        std::cout << tapes << " tapes: " << (uint64_t)best << " steps/s"
+                  << std::endl;
+
+        // Random read tuples, matched in every state by both kernels.
+        const RuleMatcher matcher(tm);
+        uint32_t seed = 1;
+        vector<uint8_t> tuples(4096 * matcher.width());
+        for (size_t t = 0; t < 4096; ++t)
+            for (uint32_t i = 0; i < tapes; ++i)
+                tuples[t * matcher.width() + i] =
+                    symbols[lcg(seed) % symbols.size()];
+        for (int kernel = 0; kernel < 2; ++kernel) {
+            double bestNs = 1e100;
+            int64_t check = 0;
+            for (int i = 0; i < rounds; ++i) {
+                check = 0;
+                const auto start = std::chrono::steady_clock::now();
+                for (size_t t = 0; t < 4096; ++t) {
+                    const auto *read = &tuples[t * matcher.width()];
+                    for (StateIdx s = 0; s < states; ++s)
+                        check += kernel ? matcher.matchScalar(s, read)
+                                        : matcher.match(s, read);
+                }
+                const std::chrono::duration<double> elapsed =
+                    std::chrono::steady_clock::now() - start;
+                bestNs = std::min(bestNs,
+                                  elapsed.count() * 1e9 / 4096 / states);
+            }
+            std::cout << "  " << (kernel ? "scalar" : "packed") << ": "
+                      << bestNs << " ns/match (checksum " << check << ")"
+                      << std::endl;
+        }
+    }
+}
@@ -0,0 +1,61 @@
+// Parser benchmark: times parseTm on synthetic machines with many
+// transition lines.
+#include "parser.h"
+#include "tm.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sys/resource.h>
+
+// A two-tape machine with the given number of states, each having one rule
+// per pair of symbols read, plus comments and blank lines like real files.
+static string synthetic(size_t states) {
+    const string symbols = "01abcxyz";
+    string res = "; synthetic machine\n#Q = {";
+    for (size_t i = 0; i < states; ++i)
+        res += (i ? ",s" : "s") + std::to_string(i);
+    res += "}\n#S = {0,1}\n#G = {0,1,a,b,c,x,y,z,_}\n#q0 = s0\n#B = _\n"
+           "#F = {s0}\n#N = 2\n\n";
+    for (size_t i = 0; i < states; ++i) {
+        res += "; state s" + std::to_string(i) + "\n";
+        for (char a : symbols) {
+            for (char b : symbols) {
+                res += "s" + std::to_string(i) + ' ' + a + b + ' ' + b + a +
+                       " r* s" + std::to_string((i * 7 + a + b) % states) +
+                       "  ; rule\n";
+            }
+        }
+    }
+    return res;
+}
+
+// Peak resident set size of the process so far, which with the sizes run in
+// increasing order is that of the largest machine parsed.
+static long peakRss() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss >> 10;
+}
+
+int main(int argc, char **argv) {
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 3;
+    for (size_t states : {100, 1000, 4000, 16000}) {
+        const auto text = synthetic(states);
+        double best = 1e100;
+        for (int i = 0; i < rounds; ++i) {
+            const auto start = std::chrono::steady_clock::now();
+            const auto res = parseTm(text);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            if (res.isL()) {
+                std::cerr << (string)res.getL() << std::endl;
+                return 1;
+            }
+            best = std::min(best, elapsed.count());
+        }
+        std::cout << states * 64 << " rules (" << (text.size() >> 10)
+                  << " KiB): " << best * 1000 << " ms, "
+                  << text.size() / best / (1 << 20) << " MiB/s, peak RSS "
+                  << peakRss() << " MiB" << std::endl;
+    }
+}
@@ -0,0 +1,371 @@
+// Benchmark suite run by `make bench`: a fixed set of workloads over the
+// machines in programs/ and tests/ and generated stress machines, each in
+// a child process of its own so that its peak RSS can be measured. Writes
+// one JSON document to stdout, meant to be kept and diffed between
+// releases, and a readable summary to stderr.
+#include "nondet.h"
+#include "parser.h"
+#include "tm.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Bumped whenever a workload changes, so that results of different suites
+// are not compared.
+static const int SUITE_VERSION = 1;
+
+// Every allocation of the process, counted while a workload is measured.
+// Atomic, as the nondeterministic search allocates from several threads.
+static std::atomic<bool> counting(false);
+static std::atomic<uint64_t> allocCount(0), allocBytes(0);
+
+void *operator new(size_t n) {
+    if (counting.load(std::memory_order_relaxed)) {
+        allocCount.fetch_add(1, std::memory_order_relaxed);
+        allocBytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+struct Sample {
+    // Steps run, or configurations visited by a nondeterministic search.
+    uint64_t steps = 0;
+    // Best time over the rounds, in seconds.
+    double seconds = 0;
+    double parseSeconds = 0;
+    // Allocations in one round.
+    uint64_t allocs = 0, allocBytes = 0;
+    string result;
+};
+
+struct Workload {
+    string name, size;
+    std::function<Sample()> run;
+};
+
+static int rounds = 3;
+
+// Times f over the rounds, counting the allocations of the last one.
+template <class F> static double timed(F f) {
+    double best = 1e100;
+    for (int i = 0; i < rounds; ++i) {
+        allocCount = 0;
+        allocBytes = 0;
+        counting = i + 1 == rounds;
+        const auto start = std::chrono::steady_clock::now();
+        f();
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        counting = false;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+static Tm parse(const string &text, double &seconds) {
+    optional<Tm> tm;
+    seconds = timed([&]() {
+        const auto res = parseTm(text);
+        if (res.isL()) {
+            std::cerr << (string)res.getL() << std::endl;
+            std::exit(1);
+        }
+        tm = res.getR();
+    });
+    return tm.value();
+}
+
+static string readText(const string &path) {
+    const auto file = mapFile(path);
+    if (file.isL()) {
+        std::cerr << "Cannot read " << path << std::endl;
+        std::exit(1);
+    }
+    return string(file.getR().text());
+}
+
+// Runs tm on input for at most budget steps.
+static Sample runMachine(const string &text, const string &input,
+                         uint64_t budget = UINT64_MAX) {
+    Sample res;
+    const auto tm = parse(text, res.parseSeconds);
+    res.seconds = timed([&]() {
+        auto id = tm.initialId(input);
+        res.steps = tm.run(id, budget);
+        res.result = id.contents(0).substr(0, 32);
+    });
+    res.allocs = allocCount;
+    res.allocBytes = allocBytes;
+    return res;
+}
+
+static Sample searchMachine(const string &text, const string &input) {
+    Sample res;
+    const auto tm = parse(text, res.parseSeconds);
+    res.seconds = timed([&]() {
+        const auto found = searchAll(tm, tm.initialId(input), RunLimits());
+        res.steps = found.configs;
+        res.result = found.outcome == SearchResult::Accept ? "accept" : "no";
+    });
+    res.allocs = allocCount;
+    res.allocBytes = allocBytes;
+    return res;
+}
+
+static Sample parseMachine(const string &text) {
+    Sample res;
+    parse(text, res.parseSeconds);
+    res.allocs = allocCount;
+    res.allocBytes = allocBytes;
+    return res;
+}
+
+static string header(const string &states, const string &symbols,
+                     const string &tapeSymbols, const string &initial,
+                     const string &final, uint32_t tapes) {
+    return "#Q = {" + states + "}\n#S = {" + symbols + "}\n#G = {" +
+           tapeSymbols + "}\n#q0 = " + initial + "\n#B = _\n#F = {" + final +
+           "}\n#N = " + std::to_string(tapes) + "\n";
+}
+
+// Appends the input with one more 1 on the right, walking back to the
+// start after each: n increments take about n^2 steps. Never halts.
+static string unaryCounter() {
+    return header("fwd,back,halt", "1", "1,_", "fwd", "halt", 1) +
+           "fwd 1 1 r fwd\n"
+           "fwd _ 1 l back\n"
+           "back 1 1 l back\n"
+           "back _ _ r fwd\n";
+}
+
+// Adds two binary numbers a+b, most significant bit first: copies them to
+// tapes 1 and 2 and adds from the right, writing the sum on tape 0.
+static string binaryAdder() {
+    string res = header("cpa,cpb,add0,add1,done", "0,1,+", "0,1,+,_", "cpa",
+                        "done", 3) +
+                 "cpa 0__ _0_ rr* cpa\n"
+                 "cpa 1__ _1_ rr* cpa\n"
+                 "cpa +__ ___ r** cpb\n"
+                 "cpb 0__ __0 r*r cpb\n"
+                 "cpb 1__ __1 r*r cpb\n"
+                 "cpb ___ ___ *ll add0\n"
+                 "add0 ___ ___ *** done\n"
+                 "add1 ___ 1__ *** done\n";
+    const string bits = "01_";
+    for (int carry = 0; carry < 2; ++carry) {
+        for (char a : bits) {
+            for (char b : bits) {
+                if (a == '_' && b == '_')
+                    continue;
+                const int sum = carry + (a == '1') + (b == '1');
+                res += "add" + std::to_string(carry) + " _" + a + b + ' ' +
+                       (sum % 2 ? '1' : '0') + a + b + " lll add" +
+                       std::to_string(sum / 2) + '\n';
+            }
+        }
+    }
+    return res;
+}
+
+// Copies tape 0 onto every other tape, then walks all heads back. With 16
+// tapes the transition table is too large and rules are matched instead.
+static string wideCopier(uint32_t tapes) {
+    const string rest(tapes - 1, '_'), any(tapes, '*');
+    string res = header("copy,back,done", "0,1", "0,1,_", "copy", "done",
+                        tapes);
+    for (char c : string("01"))
+        res += "copy " + string(1, c) + rest + ' ' + string(tapes, c) + ' ' +
+               string(tapes, 'r') + " copy\n";
+    res += "copy _" + rest + ' ' + any + ' ' + string(tapes, 'l') + " back\n";
+    for (char c : string("01"))
+        res += "back " + string(tapes, c) + ' ' + any + ' ' +
+               string(tapes, 'l') + " back\n";
+    res += "back _" + rest + ' ' + any + ' ' + any + " done\n";
+    return res;
+}
+
+// A two-tape machine of 64 rules per state, for timing the parser.
+static string manyRules(size_t states) {
+    const string symbols = "01abcxyz";
+    string names;
+    for (size_t i = 0; i < states; ++i)
+        names += (i ? ",s" : "s") + std::to_string(i);
+    string res =
+        header(names, "0,1", "0,1,a,b,c,x,y,z,_", "s0", "s0", 2) + "\n";
+    for (size_t i = 0; i < states; ++i) {
+        for (char a : symbols) {
+            for (char b : symbols) {
+                res += "s" + std::to_string(i) + ' ' + a + b + ' ' + b + a +
+                       " r* s" + std::to_string((i * 7 + a + b) % states) +
+                       "  ; rule\n";
+            }
+        }
+    }
+    return res;
+}
+
+static string palindrome(size_t n) {
+    string res(n, '0');
+    for (size_t i = 0; i < (n + 1) / 2; ++i)
+        res[i] = res[n - 1 - i] = "10"[(i * 7 + i / 3) % 2];
+    return res;
+}
+
+static string binary(uint64_t n) {
+    string res;
+    for (; n; n >>= 1)
+        res.insert(res.begin(), "01"[n & 1]);
+    return res.empty() ? "0" : res;
+}
+
+static string quote(const string &s) {
+    string res = "\"";
+    for (auto c : s)
+        res += c == '"' || c == '\\' ? string("\\") + c : string(1, c);
+    return res + "\"";
+}
+
+// Runs w in a child process, returning its fields as JSON, or an empty
+// string if it failed.
+static string measure(const Workload &w) {
+    int fds[2];
+    if (pipe(fds) != 0)
+        return "";
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return "";
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        const auto s = w.run();
+        const auto rate = s.seconds > 0 ? s.steps / s.seconds : 0;
+        const auto out =
+            "\"steps\": " + std::to_string(s.steps) +
+            ", \"seconds\": " + std::to_string(s.seconds) +
+            ", \"steps_per_second\": " + std::to_string((uint64_t)rate) +
+            ", \"parse_ms\": " + std::to_string(s.parseSeconds * 1000) +
+            ", \"allocations\": " + std::to_string(s.allocs) +
+            ", \"allocated_bytes\": " + std::to_string(s.allocBytes) +
+            ", \"result\": " + quote(s.result);
+        const bool ok = write(fds[1], out.data(), out.size()) ==
+                        (ssize_t)out.size();
+        _exit(ok ? 0 : 1);
+    }
+    close(fds[1]);
+    string out;
+    char buf[4096];
+    for (ssize_t n; (n = read(fds[0], buf, sizeof buf)) > 0;)
+        out.append(buf, n);
+    close(fds[0]);
+    int status;
+    rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return "";
+    return out + ", \"peak_rss_kib\": " + std::to_string(usage.ru_maxrss);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 1)
+        rounds = std::max(1, std::atoi(argv[1]));
+    const auto gcd = readText("../programs/gcd.tm");
+    const auto isSqrt = readText("../programs/is_sqrt.tm");
+    const auto pal = readText("tests/palindrome_detector_2tapes.tm");
+    const auto abba = readText("tests/abba.tm");
+    const auto guess = readText("tests/guess.tm");
+    const auto counter = unaryCounter(), adder = binaryAdder();
+    const auto copier8 = wideCopier(8), copier16 = wideCopier(16);
+
+    vector<Workload> workloads;
+    // Coprime operands, which take the most rounds of subtraction.
+    for (size_t n : {1000, 4000, 16000})
+        workloads.push_back({"gcd", std::to_string(n), [&gcd, n]() {
+                                 return runMachine(
+                                     gcd, string(n, '1') + "0" +
+                                              string(n * 7 / 10 + 1, '1'));
+                             }});
+    for (size_t k : {30, 300, 1000})
+        workloads.push_back({"is_sqrt", std::to_string(k * k), [&isSqrt, k]() {
+                                 return runMachine(isSqrt, string(k * k, '1'));
+                             }});
+    for (size_t n : {1 << 10, 1 << 16, 1 << 20})
+        workloads.push_back({"palindrome", std::to_string(n), [&pal, n]() {
+                                 return runMachine(pal, palindrome(n));
+                             }});
+    for (size_t n : {1000, 100000})
+        workloads.push_back({"abba_nondet", std::to_string(n), [&abba, n]() {
+                                 string in;
+                                 while (in.size() + 4 < n)
+                                     in += "ab";
+                                 return searchMachine(abba, in + "abba");
+                             }});
+    for (size_t n : {12, 16})
+        workloads.push_back({"guess_nondet", std::to_string(n), [&guess, n]() {
+                                 return searchMachine(guess,
+                                                      palindrome(n));
+                             }});
+    for (uint64_t steps : {1000000, 20000000})
+        workloads.push_back(
+            {"unary_counter", std::to_string(steps), [&counter, steps]() {
+                 return runMachine(counter, "1", steps);
+             }});
+    for (size_t bits : {64, 4096, 1 << 18})
+        workloads.push_back({"binary_adder", std::to_string(bits),
+                             [&adder, bits]() {
+                                 return runMachine(adder,
+                                                   palindrome(bits) + "+" +
+                                                       palindrome(bits - 1));
+                             }});
+    workloads.push_back({"binary_adder", "sanity", [&adder]() {
+                             return runMachine(adder, binary(1000003) + "+" +
+                                                          binary(999999));
+                         }});
+    for (size_t n : {1 << 10, 1 << 20}) {
+        workloads.push_back({"copier_8_tapes", std::to_string(n),
+                             [&copier8, n]() {
+                                 return runMachine(copier8, palindrome(n));
+                             }});
+        workloads.push_back({"copier_16_tapes", std::to_string(n),
+                             [&copier16, n]() {
+                                 return runMachine(copier16, palindrome(n));
+                             }});
+    }
+    for (size_t states : {1600, 16000})
+        workloads.push_back(
+            {"parse", std::to_string(states * 64),
+             [states]() { return parseMachine(manyRules(states)); }});
+
+    std::cout << "{\"suite\": " << SUITE_VERSION
+              << ", \"rounds\": " << rounds << ", \"workloads\": [";
+    bool failed = false, written = false;
+    for (const auto &w : workloads) {
+        const auto fields = measure(w);
+        if (fields.empty()) {
+            std::cerr << w.name << " " << w.size << ": failed" << std::endl;
+            failed = true;
+            continue;
+        }
+        std::cout << (written ? ",\n  " : "\n  ") << "{\"name\": "
+                  << quote(w.name) << ", \"size\": " << quote(w.size) << ", "
+                  << fields << "}";
+        written = true;
+        std::cerr << w.name << " " << w.size << ": " << fields << std::endl;
+    }
+    std::cout << "\n]}" << std::endl;
+    return failed;
+}
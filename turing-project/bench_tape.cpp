@@ -0,0 +1,93 @@
+// Tape micro-benchmark: runs the two-tape palindrome detector over
+// megabyte-sized inputs and reports simulation throughput, then times
+// input validation and the extraction of a large result.
+#include "parser.h"
+#include "tm.h"
+#include "utils.h"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+static const string tm_path = "tests/palindrome_detector_2tapes.tm";
+
+// A binary palindrome of length n.
+static string palindrome(size_t n) {
+    string res(n, '0');
+    for (size_t i = 0; i < (n + 1) / 2; ++i)
+        res[i] = res[n - 1 - i] = "10"[(i * 7 + i / 3) % 2];
+    return res;
+}
+
+int main(int argc, char **argv) {
+    const auto file = mapFile(tm_path);
+    if (file.isL()) {
+        std::cerr << "Cannot read " << tm_path << std::endl;
+        return 1;
+    }
+    const auto parsed = parseTm(file.getR().text());
+    if (parsed.isL()) {
+        std::cerr << (string)parsed.getL() << std::endl;
+        return 1;
+    }
+    const auto &tm = parsed.getR();
+    const int rounds = argc > 1 ? std::atoi(argv[1]) : 3;
+    for (size_t mb : {1, 2, 4, 8}) {
+        const auto input = palindrome(mb << 20);
+        double best = 0;
+        uint64_t steps = 0;
+        string result;
+        for (int i = 0; i < rounds; ++i) {
+            auto id = tm.initialId(input);
+            const auto start = std::chrono::steady_clock::now();
+            steps = tm.run(id, UINT64_MAX);
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            best = std::max(best, steps / elapsed.count());
+            result = id.contents(0);
+        }
+        std::cout << mb << " MiB: " << steps << " steps, " << (uint64_t)best
+                  << " steps/s, result " << result << std::endl;
+    }
+    const auto input = palindrome(64 << 20);
+    double best = 1e100;
+    for (int i = 0; i < rounds; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        if (!tm.validate(input))
+            return 1;
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    std::cout << "validate 64 MiB: " << best * 1000 << " ms, "
+              << 64 / best / 1024 << " GiB/s" << std::endl;
+    // A result between two erased stretches of 16 MiB, as a machine that
+    // cleans up its work space leaves it.
+    const int32_t pad = 16 << 20;
+    const string zeros(pad, '0');
+    auto id = tm.initialId(zeros + input + zeros);
+    for (int32_t k = 0; k < pad; ++k) {
+        id.position(0, k);
+        id.put(0, tm.blankChar());
+        id.position(0, pad + input.size() + k);
+        id.put(0, tm.blankChar());
+    }
+    for (bool copied : {false, true}) {
+        best = 1e100;
+        size_t size = 0;
+        for (int i = 0; i < rounds; ++i) {
+            // A fresh copy, which has not found the bounds yet.
+            const auto copy = id;
+            const auto start = std::chrono::steady_clock::now();
+            size = copied ? copy.contents(0).size()
+                          : copy.contentsView(0).size();
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        if (size != input.size())
+            return 1;
+        std::cout << (copied ? "contents" : "contentsView") << " 64 MiB: "
+                  << best * 1000 << " ms, " << 64 / best / 1024 << " GiB/s"
+                  << std::endl;
+    }
+}
@@ -0,0 +1,159 @@
+#include "cycle.h"
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+static const uint64_t MOD = (1ull << 61) - 1;
+// Bases for cell positions and for combining the tapes.
+static const uint64_t X = 0x1b8e5c3d7a92f46ull, Y = 0x3c6ef372fe94f82ull;
+
+static uint64_t add(uint64_t a, uint64_t b) {
+    const auto s = a + b;
+    return s >= MOD ? s - MOD : s;
+}
+
+static uint64_t sub(uint64_t a, uint64_t b) {
+    return a >= b ? a - b : a + MOD - b;
+}
+
+static uint64_t mul(uint64_t a, uint64_t b) {
+    const uint128_t p = (uint128_t)a * b;
+    return add((uint64_t)(p & MOD), (uint64_t)(p >> 61));
+}
+
+static uint64_t power(uint64_t a, uint64_t e) {
+    uint64_t res = 1;
+    for (; e; e >>= 1, a = mul(a, a))
+        if (e & 1)
+            res = mul(res, a);
+    return res;
+}
+
+static const uint64_t X_INV = power(X, MOD - 2);
+
+// Blank cells contribute nothing, so the tapes can grow freely.
+static uint64_t sym(char c, char blank) {
+    return c == blank ? 0 : (unsigned char)c + 1;
+}
+
+ConfigHash::ConfigHash(const Id &id)
+    : _sum(id.tapeCount()), _pow(id.tapeCount()), _invPow(id.tapeCount()) {
+    const auto blank = id.blankChar();
+    for (uint32_t i = 0; i < id.tapeCount(); ++i) {
+        // Positions are counted from the cell under the head at the start.
+        const auto bounds = id.nonBlankRange(i);
+        const int64_t d = (int64_t)bounds.first - id.position(i);
+        auto w = d >= 0 ? power(X, d) : power(X_INV, -d);
+        for (const auto c : id.contentsView(i)) {
+            _sum[i] = add(_sum[i], mul(sym(c, blank), w));
+            w = mul(w, X);
+        }
+        _pow[i] = 1;
+        _invPow[i] = 1;
+    }
+}
+
+bool ConfigHash::step(const Tm &tm, Id &id) {
+    const auto r = tm.match(id);
+    if (r < 0)
+        return false;
+    apply(tm, id, r);
+    return true;
+}
+
+void ConfigHash::apply(const Tm &tm, Id &id, uint32_t r) {
+    const auto blank = id.blankChar();
+    const auto *put = tm.rulePut(r);
+    const auto *dirs = tm.ruleDirs(r);
+    for (uint32_t i = 0; i < id.tapeCount(); ++i) {
+        const auto old = id.get(i);
+        if (put[i] >= 0 && (char)put[i] != old) {
+            const auto delta = sub(sym(put[i], blank), sym(old, blank));
+            _sum[i] = add(_sum[i], mul(delta, _pow[i]));
+        }
+        if (dirs[i] == R) {
+            _pow[i] = mul(_pow[i], X);
+            _invPow[i] = mul(_invPow[i], X_INV);
+        } else if (dirs[i] == L) {
+            _pow[i] = mul(_pow[i], X_INV);
+            _invPow[i] = mul(_invPow[i], X);
+        }
+    }
+    tm.apply(id, r);
+}
+
+uint64_t ConfigHash::value(const Id &id) const {
+    uint64_t res = id.state();
+    for (uint32_t i = 0; i < _sum.size(); ++i)
+        res = add(mul(res, Y), mul(_sum[i], _invPow[i]));
+    return res;
+}
+
+// Whether a and b have the same state and the same tapes relative to
+// their heads.
+bool sameConfig(const Id &a, const Id &b) {
+    if (a.state() != b.state() || a.tapeCount() != b.tapeCount())
+        return false;
+    for (uint32_t i = 0; i < a.tapeCount(); ++i) {
+        const auto ra = a.nonBlankRange(i), rb = b.nonBlankRange(i);
+        if (ra.second - ra.first != rb.second - rb.first)
+            return false;
+        if (ra.first == ra.second)
+            continue;
+        if (ra.first - a.position(i) != rb.first - b.position(i) ||
+            a.contentsView(i) != b.contentsView(i))
+            return false;
+    }
+    return true;
+}
+
+CycleDetector::CycleDetector(const Tm &tm, const Id &id)
+    : _tm(tm), _start(id), _saved(id), _hash(id), _savedStep(0), _steps(0),
+      _power(1), _found(false), _cycleStart(0), _cycleLength(0),
+      _cycleState(id.state()) {
+    _savedHash = _hash.value(id);
+}
+
+bool CycleDetector::step(Id &id) {
+    if (!_hash.step(_tm, id))
+        return false;
+    ++_steps;
+    const auto h = _hash.value(id);
+    if (h == _savedHash && sameConfig(id, _saved)) {
+        _cycleLength = _steps - _savedStep;
+        _locate();
+        return true;
+    }
+    if (_steps - _savedStep == _power) {
+        _saved = id;
+        _savedHash = h;
+        _savedStep = _steps;
+        _power *= 2;
+    }
+    return true;
+}
+
+// Finds the first step of the cycle by running the machine again from the
+// start, alongside a second run that is _cycleLength steps ahead.
+void CycleDetector::_locate() {
+    Id a = _start, b = _start;
+    ConfigHash ha(a), hb(b);
+    for (uint64_t i = 0; i < _cycleLength; ++i)
+        hb.step(_tm, b);
+    uint64_t step = 0;
+    while (ha.value(a) != hb.value(b) || !sameConfig(a, b)) {
+        ha.step(_tm, a);
+        hb.step(_tm, b);
+        ++step;
+    }
+    _cycleStart = step;
+    _cycleState = a.state();
+    _found = true;
+}
+
+bool CycleDetector::found() const { return _found; }
+
+uint64_t CycleDetector::cycleStart() const { return _cycleStart; }
+
+uint64_t CycleDetector::cycleLength() const { return _cycleLength; }
+
+StateIdx CycleDetector::cycleState() const { return _cycleState; }
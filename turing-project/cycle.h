@@ -0,0 +1,60 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_CYCLE_H
+#define _FLA_CYCLE_H
+#include "tm.h"
+
+// A hash of the configuration of an Id relative to its heads: the state
+// and, for every tape, the non-blank cells by their offset from the head.
+// Configurations that differ only by a shift of some tapes hash alike, and
+// lead to the same run shifted alike. Kept up to date in O(tapes) per step
+// by moving the run through step().
+class ConfigHash {
+  private:
+    // Per tape: the sum of sym(c) * X^pos over the cells, and X^head,
+    // X^-head, all modulo 2^61 - 1.
+    vector<uint64_t> _sum, _pow, _invPow;
+
+  public:
+    ConfigHash(const Id &);
+    // Runs one transition of tm on id; false if it has halted.
+    bool step(const Tm &, Id &);
+    // Applies rule r of tm to id.
+    void apply(const Tm &, Id &, uint32_t r);
+    uint64_t value(const Id &) const;
+};
+
+// Detects a run that repeats a configuration (up to shifts of the tapes),
+// which then never halts, with Brent's algorithm: the run is compared with
+// a saved configuration that is moved up to the current one whenever the
+// distance to it reaches the next power of two. Matching hashes are
+// confirmed by comparing the configurations. Three configurations are
+// held throughout: the start of the run, the saved one and the caller's
+// current one. Once a cycle is found, _locate() replays the run from the
+// start with two more.
+class CycleDetector {
+  private:
+    const Tm &_tm;
+    Id _start, _saved;
+    ConfigHash _hash;
+    uint64_t _savedHash, _savedStep, _steps, _power;
+    bool _found;
+    uint64_t _cycleStart, _cycleLength;
+    StateIdx _cycleState;
+    void _locate();
+
+  public:
+    // id is the configuration at step 0 of the run.
+    CycleDetector(const Tm &, const Id &);
+    // Runs one transition of tm on id, which must be the run's current
+    // configuration; false if it has halted.
+    bool step(Id &);
+    bool found() const;
+    // Once found(): the run enters a cycle of cycleLength() steps at step
+    // cycleStart(), in state cycleState().
+    uint64_t cycleStart() const;
+    uint64_t cycleLength() const;
+    StateIdx cycleState() const;
+};
+
+bool sameConfig(const Id &, const Id &);
+#endif
@@ -0,0 +1,230 @@
+#include "debugger.h"
+#include "trace.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <sstream>
+
+// The most snapshots kept before they are thinned out.
+static const size_t MAX_SNAPSHOTS = 64;
+
+Debugger::Debugger(const Tm &tm, Id id, uint64_t interval)
+    : _tm(tm), _id(std::move(id)), _step(0), _window(interval),
+      _interval(interval) {
+    _snapshot();
+}
+
+const Id &Debugger::id() const { return _id; }
+
+uint64_t Debugger::step() const { return _step; }
+
+void Debugger::_snapshot() {
+    if (!_snapshots.empty() && _snapshots.back().first >= _step)
+        return;
+    _snapshots.emplace_back(_step, _id);
+    if (_snapshots.size() > MAX_SNAPSHOTS) {
+        _interval *= 2;
+        _snapshots.erase(
+            std::remove_if(_snapshots.begin(), _snapshots.end(),
+                           [this](const pair<uint64_t, Id> &s) {
+                               return s.first % _interval != 0;
+                           }),
+            _snapshots.end());
+    }
+}
+
+bool Debugger::forward() {
+    const auto r = _tm.match(_id);
+    if (r < 0)
+        return false;
+    _undo.push_back({(uint32_t)r, _id.state()});
+    for (uint32_t i = 0; i < _id.tapeCount(); ++i)
+        _cells.push_back(_id.get(i));
+    _tm.apply(_id, r);
+    ++_step;
+    if (_undo.size() > 2 * _window) {
+        _undo.erase(_undo.begin(), _undo.begin() + _window);
+        _cells.erase(_cells.begin(),
+                     _cells.begin() + _window * _id.tapeCount());
+    }
+    if (_step % _interval == 0)
+        _snapshot();
+    return true;
+}
+
+void Debugger::_undoLast() {
+    const auto u = _undo.back();
+    const auto *dirs = _tm.ruleDirs(u.rule);
+    const auto base = _cells.size() - _id.tapeCount();
+    for (uint32_t i = 0; i < _id.tapeCount(); ++i) {
+        _id.move(i, dirs[i] == R ? L : dirs[i] == L ? R : N);
+        _id.put(i, _cells[base + i]);
+    }
+    _id.state(u.state);
+    _cells.resize(base);
+    _undo.pop_back();
+    --_step;
+}
+
+void Debugger::back(uint64_t n) {
+    const auto target = _step - std::min(n, _step);
+    while (_step > target && !_undo.empty())
+        _undoLast();
+    if (_step == target)
+        return;
+    auto it = std::upper_bound(
+        _snapshots.begin(), _snapshots.end(), target,
+        [](uint64_t step, const pair<uint64_t, Id> &s) {
+            return step < s.first;
+        });
+    --it;
+    _id = it->second;
+    _step = it->first;
+    _undo.clear();
+    _cells.clear();
+    while (_step < target)
+        forward();
+}
+
+static bool parseCount(const string &s, uint64_t &n) {
+    char *end;
+    errno = 0;
+    n = std::strtoull(s.c_str(), &end, 10);
+    return !errno && !*end && !s.empty() && s[0] != '-';
+}
+
+static const char *const HELP =
+    "s|step [N]          run N steps (default 1)\n"
+    "b|back [N]          go back N steps (default 1)\n"
+    "goto N              go to step N\n"
+    "until STATE         run until the machine enters STATE\n"
+    "c|continue          run until a breakpoint or the machine halts\n"
+    "break state STATE   stop when the machine enters STATE\n"
+    "break symbol T C    stop when head T reads C\n"
+    "delete              remove all breakpoints\n"
+    "p|print             show the current step\n"
+    "q|quit              leave\n";
+
+void runDebugger(const Tm &tm, const string &input, std::istream &in,
+                 std::ostream &out, uint64_t interval, uint64_t maxSteps,
+                 bool prompt) {
+    Debugger dbg(tm, tm.initialId(input), interval);
+    unordered_map<string, StateIdx> states;
+    for (StateIdx s = 0; s < tm.stateCount(); ++s)
+        states.emplace(tm.stateName(s), s);
+    unordered_set<StateIdx> stateBreaks;
+    vector<pair<uint32_t, char>> symbolBreaks;
+
+    const auto print = [&]() {
+        TraceWriter trace(tm, out, TraceWriter::Human);
+        trace.write(dbg.step(), dbg.id());
+    };
+    // Runs at most n steps, until stop(previous state) holds after one of
+    // them, and tells why it ended early.
+    const auto run = [&](uint64_t n, auto stop) {
+        for (uint64_t k = 0; k < n; ++k) {
+            const auto prev = dbg.id().state();
+            if (dbg.step() == maxSteps) {
+                out << "Step budget exhausted\n";
+                return;
+            }
+            if (!dbg.forward()) {
+                out << "Halted\n";
+                return;
+            }
+            if (stop(prev))
+                return;
+        }
+    };
+    const auto atBreakpoint = [&](StateIdx prev) {
+        const auto &id = dbg.id();
+        if (id.state() != prev && stateBreaks.count(id.state())) {
+            out << "Breakpoint: state " << tm.stateName(id.state()) << '\n';
+            return true;
+        }
+        for (const auto &b : symbolBreaks) {
+            if (id.get(b.first) == b.second) {
+                out << "Breakpoint: symbol " << b.second << " on tape "
+                    << b.first << '\n';
+                return true;
+            }
+        }
+        return false;
+    };
+    const auto never = [](StateIdx) { return false; };
+
+    print();
+    string line;
+    while (true) {
+        if (prompt)
+            out << "(turing) " << std::flush;
+        if (!std::getline(in, line))
+            break;
+        std::istringstream args(line);
+        string cmd, arg;
+        uint64_t n = 1;
+        if (!(args >> cmd))
+            continue;
+        if (cmd == "q" || cmd == "quit") {
+            break;
+        } else if (cmd == "s" || cmd == "step") {
+            if (args >> arg && !parseCount(arg, n)) {
+                out << "Invalid step count: " << arg << '\n';
+                continue;
+            }
+            run(n, never);
+        } else if (cmd == "b" || cmd == "back") {
+            if (args >> arg && !parseCount(arg, n)) {
+                out << "Invalid step count: " << arg << '\n';
+                continue;
+            }
+            dbg.back(n);
+        } else if (cmd == "goto") {
+            if (!(args >> arg) || !parseCount(arg, n)) {
+                out << "Expecting a step\n";
+                continue;
+            }
+            if (n < dbg.step())
+                dbg.back(dbg.step() - n);
+            else
+                run(n - dbg.step(), never);
+        } else if (cmd == "until") {
+            if (!(args >> arg) || !states.count(arg)) {
+                out << "Expecting a state\n";
+                continue;
+            }
+            const auto target = states.at(arg);
+            run(UINT64_MAX, [&](StateIdx prev) {
+                return prev != target && dbg.id().state() == target;
+            });
+        } else if (cmd == "c" || cmd == "continue") {
+            run(UINT64_MAX, atBreakpoint);
+        } else if (cmd == "break") {
+            string kind, tape, sym;
+            args >> kind;
+            if (kind == "state" && args >> arg && states.count(arg)) {
+                stateBreaks.insert(states.at(arg));
+            } else if (kind == "symbol" && args >> tape >> sym &&
+                       parseCount(tape, n) && n < tm.tapeCount() &&
+                       sym.size() == 1) {
+                symbolBreaks.emplace_back(n, sym[0]);
+            } else {
+                out << "Expecting break state STATE or break symbol TAPE C\n";
+            }
+            continue;
+        } else if (cmd == "delete") {
+            stateBreaks.clear();
+            symbolBreaks.clear();
+            continue;
+        } else if (cmd == "p" || cmd == "print") {
+        } else if (cmd == "h" || cmd == "help") {
+            out << HELP;
+            continue;
+        } else {
+            out << "Unknown command: " << cmd << '\n';
+            continue;
+        }
+        print();
+    }
+    out.flush();
+}
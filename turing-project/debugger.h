@@ -0,0 +1,48 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_DEBUGGER_H
+#define _FLA_DEBUGGER_H
+#include "tm.h"
+#include <deque>
+#include <istream>
+#include <ostream>
+
+// A run that can be stepped backwards as well as forwards. Every step logs
+// the state it left and the cells it overwrote, so that the last few steps
+// are undone without running the machine; the log is trimmed to the last
+// interval steps. Going back further restores the latest Id snapshot before
+// the target and runs forward from it. Snapshots are taken every interval
+// steps, and when there are too many of them every other one is dropped and
+// the interval doubled, so memory stays bounded however long the run.
+class Debugger {
+  private:
+    struct Undo {
+        uint32_t rule;
+        StateIdx state;
+    };
+    const Tm &_tm;
+    Id _id;
+    uint64_t _step, _window, _interval;
+    // _undo[k] and the tapeCount() cells from _cells[k * tapeCount()] undo
+    // step _step - _undo.size() + k + 1.
+    std::deque<Undo> _undo;
+    std::deque<char> _cells;
+    vector<pair<uint64_t, Id>> _snapshots;
+    void _snapshot();
+    void _undoLast();
+
+  public:
+    Debugger(const Tm &, Id, uint64_t interval);
+    const Id &id() const;
+    uint64_t step() const;
+    // Runs one step; false if the machine has halted.
+    bool forward();
+    // Goes back n steps, or to step 0 if there are fewer.
+    void back(uint64_t n);
+};
+
+// Reads debugger commands from in until it ends or "quit", printing the Id
+// after each of them to out.
+void runDebugger(const Tm &, const string &input, std::istream &in,
+                 std::ostream &out, uint64_t interval, uint64_t maxSteps,
+                 bool prompt);
+#endif
@@ -0,0 +1,238 @@
+#include "jit.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fstream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bumped whenever the generated code changes, to invalidate cached objects.
+static const int JIT_VERSION = 1;
+
+static string code(int16_t c) { return std::to_string((unsigned char)c); }
+
+// Emits the rules of state s that may apply when tape 0 reads c (any symbol
+// when c < 0), in the order they are tried, each jumping to its destination.
+static void emitRules(const Tm &tm, StateIdx s, int c, string &out) {
+    const auto tapes = tm.tapeCount();
+    const auto rules = tm.stateRules(s);
+    for (auto *p = rules.first; p != rules.second; ++p) {
+        const auto r = *p;
+        const auto *get = tm.ruleGet(r);
+        const auto *put = tm.rulePut(r);
+        const auto *dirs = tm.ruleDirs(r);
+        if (get[0] >= 0 && get[0] != c)
+            continue;
+        string cond;
+        for (uint32_t i = 1; i < tapes; ++i) {
+            if (get[i] < 0)
+                continue;
+            if (!cond.empty())
+                cond += " && ";
+            const auto k = std::to_string(i);
+            cond += "(unsigned char)b" + k + "[h" + k + "] == " + code(get[i]);
+        }
+        out += cond.empty() ? "        {" : "        if (" + cond + ") {";
+        string bounds;
+        for (uint32_t i = 0; i < tapes; ++i) {
+            const auto k = std::to_string(i);
+            if (put[i] >= 0)
+                out += " b" + k + "[h" + k + "] = " + code(put[i]) + ";";
+            if (dirs[i] == N)
+                continue;
+            out += dirs[i] == R ? " ++h" + k + ";" : " --h" + k + ";";
+            if (!bounds.empty())
+                bounds += " || ";
+            bounds += "(uint64_t)h" + k + " >= (uint64_t)s" + k;
+        }
+        const auto dst = std::to_string(tm.ruleDst(r));
+        out += " ++steps;";
+        if (!bounds.empty())
+            out += " if (" + bounds + ") { st = " + dst + "; goto done; }";
+        out += " goto S" + dst + "; }\n";
+        // Later rules cannot match once one without conditions has.
+        if (cond.empty())
+            break;
+    }
+}
+
+string jitSource(const Tm &tm) {
+    const auto tapes = tm.tapeCount();
+    string out = "#include <cstdint>\n"
+                 "extern \"C\" uint64_t tm_run(uint32_t *state, char *const "
+                 "*buf, const int64_t *size, int64_t *head, uint64_t "
+                 "maxSteps) {\n";
+    for (uint32_t i = 0; i < tapes; ++i) {
+        const auto k = std::to_string(i);
+        out += "    char *const b" + k + " = buf[" + k + "];\n";
+        out += "    const int64_t s" + k + " = size[" + k + "];\n";
+        out += "    int64_t h" + k + " = head[" + k + "];\n";
+    }
+    out += "    uint64_t steps = 0;\n"
+           "    uint32_t st = *state;\n"
+           "    switch (st) {\n";
+    for (StateIdx s = 0; s < tm.stateCount(); ++s) {
+        const auto name = std::to_string(s);
+        out += "    case " + name + ": goto S" + name + ";\n";
+    }
+    out += "    default: goto done;\n    }\n";
+    for (StateIdx s = 0; s < tm.stateCount(); ++s) {
+        const auto name = std::to_string(s);
+        out += "S" + name + ":\n    st = " + name + ";\n";
+        if (tm.isFinal(s)) {
+            out += "    goto done;\n";
+            continue;
+        }
+        out += "    if (steps == maxSteps) goto done;\n";
+        // The symbols tape 0 is tested against.
+        vector<int> symbols;
+        const auto rules = tm.stateRules(s);
+        for (auto *p = rules.first; p != rules.second; ++p) {
+            const auto c = tm.ruleGet(*p)[0];
+            if (c >= 0 && std::find(symbols.begin(), symbols.end(), c) ==
+                              symbols.end())
+                symbols.push_back(c);
+        }
+        out += "    switch ((unsigned char)b0[h0]) {\n";
+        for (auto c : symbols) {
+            out += "    case " + code(c) + ":\n";
+            emitRules(tm, s, c, out);
+            out += "        goto done;\n";
+        }
+        out += "    default:\n";
+        emitRules(tm, s, -1, out);
+        out += "        goto done;\n    }\n";
+    }
+    out += "done:\n    *state = st;\n";
+    for (uint32_t i = 0; i < tapes; ++i)
+        out += "    head[" + std::to_string(i) + "] = h" + std::to_string(i) +
+               ";\n";
+    out += "    return steps;\n}\n";
+    return out;
+}
+
+// Creates dir and its parents, private to the user.
+static void makeDirs(const string &dir) {
+    for (size_t k = 1; k <= dir.size(); ++k)
+        if (k == dir.size() || dir[k] == '/')
+            mkdir(dir.substr(0, k).c_str(), 0700);
+}
+
+// Whether path is a directory (isDir) or regular file of ours, not a
+// symbolic link, that no one else may write to. Only then are objects in
+// it trusted, since anyone able to plant one there could run code in our
+// process.
+static bool ownedPrivately(const string &path, bool isDir) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 &&
+           (isDir ? S_ISDIR(st.st_mode) : S_ISREG(st.st_mode)) &&
+           st.st_uid == geteuid() && !(st.st_mode & (S_IWGRP | S_IWOTH));
+}
+
+// The directory of cached objects, or nothing if there is no safe one.
+// Without a home directory, it is a directory of the user's own in /tmp.
+static optional<string> cacheDir() {
+    string dir;
+    if (const char *xdg = std::getenv("XDG_CACHE_HOME"); xdg && *xdg)
+        dir = string(xdg) + "/turing";
+    else if (const char *home = std::getenv("HOME"); home && *home)
+        dir = string(home) + "/.cache/turing";
+    else
+        dir = "/tmp/turing-cache-" + std::to_string(geteuid());
+    makeDirs(dir);
+    if (!ownedPrivately(dir, true))
+        return std::nullopt;
+    return dir;
+}
+
+static string quote(const string &s) {
+    string res = "'";
+    for (auto c : s)
+        res += c == '\'' ? string("'\\''") : string(1, c);
+    return res + "'";
+}
+
+JitMachine::JitMachine(const Tm &tm) : _tm(tm) {
+    // Without a cache, the object is built in a directory of its own and
+    // removed once loaded.
+    auto dir = cacheDir();
+    const bool cached = dir.has_value();
+    if (!cached) {
+        char tmpl[] = "/tmp/turing-jit-XXXXXX";
+        if (!mkdtemp(tmpl))
+            throw JitError{"Cannot create a directory to compile in"};
+        dir = tmpl;
+    }
+    char name[32];
+    std::snprintf(name, sizeof name, "%016llx-%d",
+                  (unsigned long long)tm.hash(), JIT_VERSION);
+    const auto base = dir.value() + "/" + name;
+    const auto object = base + ".so";
+    const auto cleanUp = [&]() {
+        if (!cached) {
+            std::remove(object.c_str());
+            rmdir(dir.value().c_str());
+        }
+    };
+    if (!ownedPrivately(object, false)) {
+        // Written under names of our own, so that concurrent runs do not
+        // see each other's partial files.
+        const auto tmp = base + "." + std::to_string(getpid());
+        const auto source = tmp + ".cpp";
+        std::ofstream(source) << jitSource(tm);
+        const char *cxx = std::getenv("CXX");
+        const auto cmd = quote(cxx && *cxx ? cxx : "c++") +
+                         " -O2 -shared -fPIC -o " + quote(tmp + ".so") + " " +
+                         quote(source);
+        const auto status = std::system(cmd.c_str());
+        std::remove(source.c_str());
+        if (status != 0 ||
+            std::rename((tmp + ".so").c_str(), object.c_str()) != 0) {
+            std::remove((tmp + ".so").c_str());
+            cleanUp();
+            throw JitError{"Cannot compile the machine with " + cmd};
+        }
+    }
+    void *handle = dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+    cleanUp();
+    if (!handle)
+        throw JitError{string("Cannot load ") + object + ": " + dlerror()};
+    _handle.reset(handle, dlclose);
+    _run = (Run)dlsym(handle, "tm_run");
+    if (!_run)
+        throw JitError{"Cannot load " + object + ": no tm_run"};
+}
+
+// The compiled code runs on the tape buffers in place. When a head moves
+// off its buffer, the buffer is grown as Tape::put() would and the run
+// goes on.
+uint64_t JitMachine::run(Id &id, uint64_t maxSteps) const {
+    const auto tapes = _tm.tapeCount();
+    vector<char *> buf(tapes);
+    vector<int64_t> first(tapes), size(tapes), head(tapes);
+    uint32_t state = id._state;
+    uint64_t steps = 0;
+    while (true) {
+        for (uint32_t i = 0; i < tapes; ++i) {
+            auto &tape = id._tapes[i];
+            tape.reserve(id._position[i]);
+            const auto ext = tape.extent();
+            buf[i] = tape.data();
+            first[i] = ext.first;
+            size[i] = ext.second - ext.first;
+            head[i] = id._position[i] - first[i];
+        }
+        steps += _run(&state, buf.data(), size.data(), head.data(),
+                      maxSteps - steps);
+        bool off = false;
+        for (uint32_t i = 0; i < tapes; ++i) {
+            id._position[i] = head[i] + first[i];
+            off |= head[i] < 0 || head[i] >= size[i];
+        }
+        if (!off || steps == maxSteps)
+            break;
+    }
+    id._state = state;
+    return steps;
+}
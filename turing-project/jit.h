@@ -0,0 +1,41 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_JIT_H
+#define _FLA_JIT_H
+#include "tm.h"
+#include <memory>
+
+struct JitError {
+    string msg;
+};
+
+// A machine translated to C++, with a label per state and the rules of the
+// state as a switch on the symbol under the first head, compiled by the
+// system compiler ($CXX, or c++) into a shared object and loaded. Objects
+// are cached by the hash of the machine under $XDG_CACHE_HOME/turing,
+// ~/.cache/turing or /tmp/turing-cache-<uid>, so only the first run of a
+// machine pays for compiling it. A cache directory that is not the user's
+// own, or that others may write to, is not used.
+class JitMachine {
+  public:
+    // Runs at most maxSteps steps on the tapes buf[i][0, size[i]), head i
+    // being at head[i], and returns the number run. Stops early when the
+    // machine halts or a head has moved off its buffer.
+    typedef uint64_t (*Run)(uint32_t *state, char *const *buf,
+                            const int64_t *size, int64_t *head,
+                            uint64_t maxSteps);
+
+  private:
+    const Tm &_tm;
+    std::shared_ptr<void> _handle;
+    Run _run;
+
+  public:
+    // Throws JitError if the machine cannot be compiled or loaded.
+    JitMachine(const Tm &);
+    // Like Tm::run.
+    uint64_t run(Id &, uint64_t) const;
+};
+
+// The C++ source of the compiled form of a machine.
+string jitSource(const Tm &);
+#endif
@@ -0,0 +1,77 @@
+#include "match.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+static const uint32_t LANES = 32;
+#else
+static const uint32_t LANES = 16;
+#endif
+
+RuleMatcher::RuleMatcher(const Tm &tm)
+    : _tapeCount(tm.tapeCount()),
+      _width((tm.tapeCount() + LANES - 1) / LANES * LANES) {
+    _start.push_back(0);
+    for (StateIdx s = 0; s < tm.stateCount(); ++s) {
+        const auto rules = tm.stateRules(s);
+        _rule.insert(_rule.end(), rules.first, rules.second);
+        _start.push_back(_rule.size());
+    }
+    _pattern.resize(_rule.size() * _width);
+    _mask.resize(_rule.size() * _width);
+    for (size_t k = 0; k < _rule.size(); ++k) {
+        const auto *get = tm.ruleGet(_rule[k]);
+        for (uint32_t i = 0; i < _tapeCount; ++i) {
+            if (get[i] >= 0) {
+                _pattern[k * _width + i] = (uint8_t)get[i];
+                _mask[k * _width + i] = 0xff;
+            }
+        }
+    }
+}
+
+uint32_t RuleMatcher::width() const { return _width; }
+
+int32_t RuleMatcher::match(StateIdx s, const uint8_t *read) const {
+#if defined(__AVX2__) || defined(__SSE2__)
+    for (auto k = _start[s]; k < _start[s + 1]; ++k) {
+        const auto *pattern = &_pattern[k * _width];
+        const auto *mask = &_mask[k * _width];
+        bool matched = true;
+        for (uint32_t off = 0; matched && off < _width; off += LANES) {
+#ifdef __AVX2__
+            const auto r = _mm256_loadu_si256((const __m256i *)(read + off));
+            const auto m = _mm256_loadu_si256((const __m256i *)(mask + off));
+            const auto p = _mm256_loadu_si256((const __m256i *)(pattern + off));
+            const auto eq = _mm256_cmpeq_epi8(_mm256_and_si256(r, m), p);
+            matched = (uint32_t)_mm256_movemask_epi8(eq) == 0xffffffffu;
+#else
+            const auto r = _mm_loadu_si128((const __m128i *)(read + off));
+            const auto m = _mm_loadu_si128((const __m128i *)(mask + off));
+            const auto p = _mm_loadu_si128((const __m128i *)(pattern + off));
+            const auto eq = _mm_cmpeq_epi8(_mm_and_si128(r, m), p);
+            matched = _mm_movemask_epi8(eq) == 0xffff;
+#endif
+        }
+        if (matched)
+            return _rule[k];
+    }
+    return -1;
+#else
+    return matchScalar(s, read);
+#endif
+}
+
+int32_t RuleMatcher::matchScalar(StateIdx s, const uint8_t *read) const {
+    for (auto k = _start[s]; k < _start[s + 1]; ++k) {
+        const auto *pattern = &_pattern[k * _width];
+        const auto *mask = &_mask[k * _width];
+        bool matched = true;
+        for (uint32_t i = 0; matched && i < _tapeCount; ++i)
+            matched = (read[i] & mask[i]) == pattern[i];
+        if (matched)
+            return _rule[k];
+    }
+    return -1;
+}
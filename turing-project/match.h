@@ -0,0 +1,27 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_MATCH_H
+#define _FLA_MATCH_H
+#include "tm.h"
+
+// The rules of every state packed for matching against a whole read tuple
+// at once, for machines too wide for a transition table. Rule k of the
+// concatenated rule lists is a pattern and a mask of width() bytes; the
+// mask is 0xff on the tapes the rule reads and 0 on wildcards and padding,
+// so that a read tuple matches when (read & mask) == pattern. match() tests
+// 16 tapes per instruction with SSE2, or 32 with AVX2 when built for it.
+class RuleMatcher {
+  private:
+    uint32_t _tapeCount, _width;
+    vector<uint32_t> _start, _rule;
+    vector<uint8_t> _pattern, _mask;
+
+  public:
+    RuleMatcher(const Tm &);
+    uint32_t width() const;
+    // The first rule of state s matching read, which holds width() bytes
+    // that are zero past the last tape, or -1.
+    int32_t match(StateIdx s, const uint8_t *read) const;
+    // The same, one tape at a time.
+    int32_t matchScalar(StateIdx s, const uint8_t *read) const;
+};
+#endif
@@ -0,0 +1,141 @@
+#include "nondet.h"
+#include "cycle.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// The visited set is split by hash so that threads rarely contend.
+static const size_t SHARDS = 64;
+// Configurations handed to a thread at a time, and the least worth starting
+// a thread for.
+static const size_t CHUNK = 64;
+static const size_t PER_THREAD = 1024;
+
+namespace {
+
+struct Node {
+    Id id;
+    ConfigHash hash;
+};
+
+// Visited configurations are kept as their ConfigHash alone, as the
+// tapes of every configuration would not fit in memory on long inputs.
+// The search is therefore probabilistic: a collision, about n^2 / 2^62
+// likely after n configurations, prunes a configuration never explored,
+// which may hide the only accepting branch.
+struct Shard {
+    std::mutex lock;
+    unordered_set<uint64_t> seen;
+};
+
+class Search {
+  private:
+    const Tm &_tm;
+    std::array<Shard, SHARDS> _shards;
+    std::atomic<uint64_t> _configs;
+    // Set once more than _maxConfigs configurations have been visited,
+    // which stops expansion at once rather than at the end of the level.
+    const uint64_t _maxConfigs;
+    std::atomic<bool> _over;
+
+  public:
+    Search(const Tm &tm, uint64_t maxConfigs)
+        : _tm(tm), _configs(0), _maxConfigs(maxConfigs), _over(false) {}
+    uint64_t configs() const { return _configs; }
+    bool over() const { return _over; }
+
+    bool visit(uint64_t h) {
+        auto &shard = _shards[h % SHARDS];
+        std::lock_guard<std::mutex> l(shard.lock);
+        if (!shard.seen.insert(h).second)
+            return false;
+        if (++_configs > _maxConfigs)
+            _over = true;
+        return true;
+    }
+
+    // Expands the nodes of level taken through next, appending the new ones
+    // to out and keeping the accepting one with the smallest hash in best.
+    void expand(vector<Node> &level, std::atomic<size_t> &next,
+                vector<Node> &out, optional<pair<uint64_t, Id>> &best) {
+        vector<uint32_t> rules;
+        while (1) {
+            const auto begin = next.fetch_add(CHUNK);
+            if (begin >= level.size())
+                return;
+            const auto end = std::min(begin + CHUNK, level.size());
+            for (auto k = begin; k < end && !_over; ++k) {
+                rules.clear();
+                _tm.matchAll(level[k].id, rules);
+                for (size_t j = 0; j < rules.size(); ++j) {
+                    // The last successor takes over the node itself.
+                    Node child = j + 1 == rules.size() ? std::move(level[k])
+                                                       : level[k];
+                    child.hash.apply(_tm, child.id, rules[j]);
+                    const auto h = child.hash.value(child.id);
+                    if (_tm.isFinal(child.id.state())) {
+                        if (!best || h < best->first)
+                            best.emplace(h, std::move(child.id));
+                    } else if (visit(h)) {
+                        if (_over)
+                            return;
+                        out.push_back(std::move(child));
+                    }
+                }
+            }
+        }
+    }
+};
+
+} // namespace
+
+SearchResult searchAll(const Tm &tm, const Id &id, const RunLimits &limits,
+                       unsigned threads) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto timedOut = [&]() {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return limits.timeout && elapsed.count() >= limits.timeout.value();
+    };
+    Search search(tm, limits.maxConfigs);
+    if (tm.isFinal(id.state()))
+        return {SearchResult::Accept, id.contents(0), id.state(), 0, 1};
+    vector<Node> level = {Node{id, ConfigHash(id)}};
+    search.visit(level[0].hash.value(id));
+    for (uint64_t step = 0;; ++step) {
+        if (level.empty())
+            return {SearchResult::Reject, "", 0, step, search.configs()};
+        if (step == limits.maxSteps || search.configs() > limits.maxConfigs ||
+            timedOut())
+            return {SearchResult::Limit, "", 0, step, search.configs()};
+        const unsigned n = std::max<size_t>(
+            1, std::min<size_t>(threads, level.size() / PER_THREAD));
+        vector<vector<Node>> out(n);
+        vector<optional<pair<uint64_t, Id>>> best(n);
+        std::atomic<size_t> next(0);
+        vector<std::thread> workers;
+        for (unsigned k = 1; k < n; ++k)
+            workers.emplace_back([&, k]() {
+                search.expand(level, next, out[k], best[k]);
+            });
+        search.expand(level, next, out[0], best[0]);
+        for (auto &t : workers)
+            t.join();
+        if (search.over())
+            return {SearchResult::Limit, "", 0, step, search.configs()};
+        optional<pair<uint64_t, Id>> found;
+        for (auto &b : best)
+            if (b && (!found || b->first < found->first))
+                found = std::move(b);
+        if (found) {
+            const auto &res = found->second;
+            return {SearchResult::Accept, res.contents(0), res.state(),
+                    step + 1, search.configs()};
+        }
+        level.clear();
+        for (auto &o : out)
+            std::move(o.begin(), o.end(), std::back_inserter(level));
+    }
+}
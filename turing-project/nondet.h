@@ -0,0 +1,30 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_NONDET_H
+#define _FLA_NONDET_H
+#include "batch.h"
+#include "tm.h"
+
+struct SearchResult {
+    // Accept: some branch reaches a final state, after steps steps.
+    // Reject: every branch halts in a non-final state or repeats itself.
+    // Limit: stopped by maxSteps, maxConfigs or timeout before either.
+    enum { Accept, Reject, Limit } outcome;
+    // Tape 0 and state of the accepting branch.
+    string contents;
+    StateIdx state;
+    uint64_t steps;
+    // Distinct configurations visited.
+    uint64_t configs;
+};
+
+// Runs tm from id following every rule that applies rather than the first,
+// breadth first, so that the shortest accepting branch is found. Each
+// configuration is kept as its ConfigHash and explored once; two differing
+// in no more than a shift of the tapes count as one, as do, rarely, two
+// whose hashes collide. Every level of the
+// search is expanded by up to threads threads, and limits.maxSteps bounds
+// its depth. When several branches accept at the same depth, the one with
+// the smallest hash is reported, so the result does not depend on threads.
+SearchResult searchAll(const Tm &, const Id &, const RunLimits &,
+                       unsigned threads = 1);
+#endif
@@ -0,0 +1,130 @@
+#include "parallel.h"
+#include <algorithm>
+
+// Inputs kept in flight per worker; bounds memory when one input runs long.
+static const size_t WINDOW_PER_THREAD = 1024;
+// Consecutive inputs queued on the same worker.
+static const size_t CHUNK = 16;
+
+ParallelRunner::ParallelRunner(const Tm &tm, const RunLimits &limits,
+                               unsigned threads)
+    : _tm(tm), _limits(limits), _pending(0), _closed(false) {
+    threads = std::max(threads, 1u);
+    _slots.resize(WINDOW_PER_THREAD * threads);
+    for (unsigned i = 0; i < threads; ++i)
+        _workers.push_back(std::make_unique<Worker>());
+    for (unsigned i = 0; i < threads; ++i)
+        _threads.emplace_back(&ParallelRunner::_work, this, i);
+}
+
+ParallelRunner::~ParallelRunner() {
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _closed = true;
+    }
+    _workCv.notify_all();
+    for (auto &t : _threads)
+        t.join();
+}
+
+// Takes the oldest task of worker self, or else steals the newest task of
+// another worker. _pending changes together with the queues, under the
+// worker's lock, so that idle workers never see it count a task that has
+// already been taken.
+bool ParallelRunner::_take(size_t self, size_t &seq) {
+    const size_t n = _workers.size();
+    for (size_t k = 0; k < n; ++k) {
+        auto &w = *_workers[(self + k) % n];
+        std::lock_guard<std::mutex> l(w.lock);
+        if (w.tasks.empty())
+            continue;
+        if (k == 0) {
+            seq = w.tasks.front();
+            w.tasks.pop_front();
+        } else {
+            seq = w.tasks.back();
+            w.tasks.pop_back();
+        }
+        std::lock_guard<std::mutex> pl(_lock);
+        --_pending;
+        return true;
+    }
+    return false;
+}
+
+void ParallelRunner::_work(size_t self) {
+    while (1) {
+        size_t seq;
+        if (!_take(self, seq)) {
+            std::unique_lock<std::mutex> l(_lock);
+            _workCv.wait(l, [this]() { return _closed || _pending > 0; });
+            if (_closed && _pending == 0)
+                return;
+            continue;
+        }
+        auto &slot = _slots[seq % _slots.size()];
+        auto result = runInput(_tm, slot.input, _limits);
+        {
+            std::lock_guard<std::mutex> l(_lock);
+            slot.result = std::move(result);
+            slot.done = true;
+        }
+        _doneCv.notify_one();
+    }
+}
+
+// Runs every input produced by next (which returns false at the end) and
+// passes the results to emit in the same order.
+void ParallelRunner::run(std::function<bool(string &)> next,
+                         std::function<void(const RunResult &)> emit) {
+    const size_t window = _slots.size();
+    size_t submitted = 0, emitted = 0;
+    bool eof = false;
+    while (1) {
+        while (!eof && submitted - emitted < window) {
+            auto &slot = _slots[submitted % window];
+            if (!next(slot.input)) {
+                eof = true;
+                break;
+            }
+            slot.done = false;
+            auto &w = *_workers[submitted / CHUNK % _workers.size()];
+            {
+                std::lock_guard<std::mutex> l(w.lock);
+                w.tasks.push_back(submitted);
+                std::lock_guard<std::mutex> pl(_lock);
+                ++_pending;
+            }
+            _workCv.notify_one();
+            ++submitted;
+        }
+        std::unique_lock<std::mutex> l(_lock);
+        if (emitted == submitted)
+            break;
+        _doneCv.wait(l, [&]() { return _slots[emitted % window].done; });
+        while (emitted < submitted && _slots[emitted % window].done) {
+            l.unlock();
+            emit(_slots[emitted % window].result);
+            l.lock();
+            ++emitted;
+        }
+    }
+}
+
+// Runs all inputs on the given number of threads.
+vector<RunResult> runInputs(const Tm &tm, const vector<string> &inputs,
+                            const RunLimits &limits, unsigned threads) {
+    vector<RunResult> res;
+    res.reserve(inputs.size());
+    size_t i = 0;
+    ParallelRunner(tm, limits, threads)
+        .run(
+            [&](string &input) {
+                if (i == inputs.size())
+                    return false;
+                input = inputs[i++];
+                return true;
+            },
+            [&res](const RunResult &r) { res.push_back(r); });
+    return res;
+}
@@ -0,0 +1,50 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_PARALLEL_H
+#define _FLA_PARALLEL_H
+#include "batch.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Runs many inputs of one machine on a pool of threads. Every worker owns a
+// queue of pending inputs, takes work from its front and, once it runs dry,
+// steals from the back of the others', so that a few long runs only occupy
+// their own workers. Results are delivered in input order.
+class ParallelRunner {
+  private:
+    struct Worker {
+        std::mutex lock;
+        std::deque<size_t> tasks;
+    };
+    struct Slot {
+        string input;
+        RunResult result;
+        bool done;
+    };
+    const Tm &_tm;
+    RunLimits _limits;
+    vector<std::unique_ptr<Worker>> _workers;
+    vector<std::thread> _threads;
+    // _slots[seq % _slots.size()] holds input seq while it is in flight.
+    vector<Slot> _slots;
+    std::mutex _lock;
+    std::condition_variable _workCv, _doneCv;
+    // Tasks in the queues, changed while holding the lock of the queue and
+    // then _lock, in that order.
+    size_t _pending;
+    bool _closed;
+    bool _take(size_t, size_t &);
+    void _work(size_t);
+
+  public:
+    ParallelRunner(const Tm &, const RunLimits &, unsigned);
+    ~ParallelRunner();
+    void run(std::function<bool(string &)>,
+             std::function<void(const RunResult &)>);
+};
+
+vector<RunResult> runInputs(const Tm &, const vector<string> &,
+                            const RunLimits &, unsigned);
+#endif
@@ -1,23 +1,18 @@
 #include "parser.h"
 #include <algorithm>
 #include <cctype>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
-#include <functional>
-#include <iostream>
-#include <iterator>
-#include <memory>
+#include <cstring>
 #include <optional>
 #include <sstream>
-#include <tuple>
-#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 using std::ptrdiff_t, std::uint32_t, std::unordered_set, std::vector,
-    std::tuple, std::optional;
+    std::optional;
 
 void Location::advance(bool newline) {
-    auto x = string("a");
     ++off;
     if (newline) {
         ++line;
@@ -46,36 +41,68 @@ ParseError::operator string() const {
     return s.str();
 }
 
+// The symbols that may appear in the input alphabet, and on tapes, where
+// '_' and '*' stand for the blank and for any symbol.
+static const Alphabet INPUT_CHARS = [] {
+    Alphabet res;
+    for (int c = 0; c < 256; ++c)
+        if (std::isgraph(c) && !std::strchr(",;{}*_", c))
+            res.insert((char)c);
+    return res;
+}();
+static const Alphabet TAPE_CHARS = [] {
+    auto res = INPUT_CHARS;
+    res.insert('_');
+    res.insert('*');
+    return res;
+}();
+
+// States in the order they are first listed, without repeats, so that
+// machines number them the same way everywhere.
+class StateList {
+  private:
+    vector<string> _names;
+    unordered_set<string> _seen;
+
+  public:
+    void insert(const string &q) {
+        if (_seen.insert(q).second)
+            _names.push_back(q);
+    }
+    vector<string>::const_iterator begin() const { return _names.begin(); }
+    vector<string>::const_iterator end() const { return _names.end(); }
+};
+
+// A single-pass recursive-descent parser. Parsing functions return false
+// on failure after recording an error message and the offset it refers to;
+// callers that can recover just rewind _pos.
 class TmParser {
   private:
-    string _text;
-    ptrdiff_t _len;
-    Location _loc;
+    string_view _text;
+    size_t _pos;
+    string _errMsg;
+    size_t _errPos;
     // tm components
-    optional<unordered_set<string>> _Q, _F;
-    optional<unordered_set<char>> _S, _G;
-    using DRule =
-        tuple<string, vector<char>, string, vector<char>, vector<Dir>>;
+    optional<StateList> _Q, _F;
+    optional<Alphabet> _S, _G;
+    struct DRule {
+        string_view src, get, dst, put, dirs;
+    };
     vector<DRule> _delta;
     optional<string> _q0;
     optional<char> _B;
     optional<uint32_t> _N;
-    constexpr static auto isStateChar = [](char c) -> bool {
-        return std::isalnum(c) || c == '_';
-    };
-    constexpr static auto isInputChar = [](char c) -> bool {
-        const static unordered_set<char> ill = {' ', ',', ';', '{',
-                                                '}', '*', '_'};
-        return std::isgraph(c) && ill.count(c) == 0;
-    };
-    constexpr static auto isTapeChar = [](char c) -> bool {
-        return isInputChar(c) || c == '_' || c == '*';
-    };
+    static bool isStateChar(char c) {
+        return std::isalnum((unsigned char)c) || c == '_';
+    }
+    static bool isInputChar(char c) { return INPUT_CHARS.count(c); }
+    static bool isTapeChar(char c) { return TAPE_CHARS.count(c); }
+    static bool isBlank(char c) { return c == ' ' || c == '\t'; }
+    static bool isDirChar(char c) { return c == 'l' || c == 'r' || c == '*'; }
 
-    void init(string text) {
+    void init(string_view text) {
         _text = text;
-        _loc = {};
-        _len = text.length();
+        _pos = 0;
         _Q.reset();
         _F.reset();
         _S.reset();
@@ -83,353 +110,261 @@ class TmParser {
         _delta.clear();
     }
 
-    void throw_(string msg) const { throw ParseError{msg, {_loc}}; }
-    void throw_if(bool cond, string msg) const {
-        if (cond)
-            throw ParseError{msg, {_loc}};
+    bool fail(string msg) {
+        _errMsg = std::move(msg);
+        _errPos = _pos;
+        return false;
     }
-    bool isEof() const { return _loc.off >= (ptrdiff_t)_text.length(); }
-    void advance() { _loc.advance(!isEof() && _text[_loc.off] == '\n'); }
-
-    auto eofP() const {
-        return [this]() {
-            if (!isEof())
-                throw_("Expected EOF");
-        };
+    Location locationOf(size_t off) const {
+        Location loc;
+        loc.off = off;
+        const auto head = _text.substr(0, off);
+        loc.line = 1 + std::count(head.begin(), head.end(), '\n');
+        const auto nl = head.rfind('\n');
+        loc.col = nl == head.npos ? off + 1 : off - nl;
+        return loc;
     }
+    bool isEof() const { return _pos >= _text.size(); }
+    char peek() const { return _text[_pos]; }
+    bool lineStart() const { return _pos == 0 || _text[_pos - 1] == '\n'; }
 
-    template <class A> auto tryP(std::function<A(void)> f) {
-        return [this, f]() {
-            auto oldloc = _loc;
-            try {
-                return Either<ParseError, A>::inr(f());
-            } catch (ParseError e) {
-                _loc = oldloc;
-                return Either<ParseError, A>::inl(e);
-            }
-        };
+    // Consumes c.
+    bool expect(char c) {
+        if (isEof())
+            return fail(string("Got EOF, expecting ") + c);
+        if (peek() != c)
+            return fail(string("Got ") + peek() + ", expecting " + c);
+        ++_pos;
+        return true;
     }
-
-    auto peekP() const {
-        return [this]() {
-            if (isEof())
-                throw_("Nothing to peek");
-            return _text[_loc.off];
-        };
+    // Consumes one char satisfying pred.
+    template <class Pred> bool one(Pred pred, char &out) {
+        if (isEof())
+            return fail("Nothing to peek");
+        if (!pred(peek()))
+            return fail(string("Unexpected ") + peek());
+        out = _text[_pos++];
+        return true;
     }
-    auto getP() {
-        return [this]() {
-            if (isEof())
-                throw_("Nothing to get");
-            advance();
-            return _text[_loc.off];
-        };
+    // Consumes one or more chars satisfying pred.
+    template <class Pred> bool some(Pred pred, string_view &out) {
+        const auto start = _pos;
+        char c;
+        if (!one(pred, c))
+            return false;
+        while (!isEof() && pred(peek()))
+            ++_pos;
+        out = _text.substr(start, _pos - start);
+        return true;
     }
-
-    auto charP(char c) {
-        return [this, c]() {
-            if (isEof())
-                throw_(string("Got EOF, expecting ") + c);
-            if (_text[_loc.off] != c)
-                throw_(string("Got ") + _text[_loc.off] + ", expecting " + c);
-            advance();
-            return c;
-        };
-    }
-    auto predP(std::function<bool(int)> pred) {
-        return [pred, this]() {
-            char c = peekP()();
-            if (pred(c)) {
-                advance();
-                return c;
-            }
-            throw_(string("Unexpected ") + c);
-            assert(0);
-        };
-    }
-    auto anyP(string range) {
-        return [range, this]() {
-            char c = peekP()();
-            if (range.find(c) != range.npos) {
-                advance();
-                return c;
-            }
-            throw_(string("Expecting any char in ") + range + " but got " + c);
-            assert(0);
-        };
-    }
-    auto skipWs() {
-        return [this]() -> void {
-            while (1) {
-                if (auto o = tryP<char>(peekP())()) {
-                    if (isspace(o.getR())) {
-                        advance();
-                    } else if (o.getR() == ';') {
-                        advance();
-                        while (auto _ = tryP<char>(
-                                   predP([](int c) { return c != '\n'; }))())
-                            ;
-                    } else {
-                        break;
-                    }
-                } else {
-                    break;
-                }
+    void skipWs() {
+        while (!isEof()) {
+            if (std::isspace((unsigned char)peek())) {
+                ++_pos;
+            } else if (peek() == ';') {
+                while (!isEof() && peek() != '\n')
+                    ++_pos;
+            } else {
+                break;
             }
-        };
+        }
     }
-
-    auto exactP(string s) {
-        return [this, s]() {
-            auto oldloc = _loc;
-            try {
-                for (char c : s)
-                    charP(c)();
-            } catch (ParseError e) {
-                _loc = oldloc;
-                throw e;
-            }
-            return s;
-        };
+    bool stateName(string_view &out) {
+        const auto start = _pos;
+        while (!isEof() && isStateChar(peek()))
+            ++_pos;
+        if (_pos == start)
+            return fail("Expecting legal state name");
+        out = _text.substr(start, _pos - start);
+        return true;
     }
-
-    auto lookaheadP(string s) {
-        return [this, s]() -> string {
-            auto oldloc = _loc;
-            try {
-                for (char c : s)
-                    charP(c)();
-            } catch (ParseError e) {
-                _loc = oldloc;
-                throw e;
-            }
-            _loc = oldloc;
-            return s;
-        };
+    bool stateAtom(string &out) {
+        string_view name;
+        if (!stateName(name))
+            return false;
+        out = string(name);
+        return true;
     }
-
-    // Should not throw
-    template <class A> auto manyP(std::function<A()> a) {
-        return [this, a]() {
-            vector<A> res;
-            while (auto x = tryP(a)()) {
-                res.push_back(x.getR());
-            }
-            return res;
-        };
+    // "#id = ", at the beginning of a line. Never records an error: a line
+    // that does not start a definition is parsed as a rule instead.
+    bool defBegin(string_view &id) {
+        skipWs();
+        if (!lineStart() || isEof() || peek() != '#')
+            return false;
+        const auto start = ++_pos;
+        while (!isEof() && std::isalnum((unsigned char)peek()))
+            ++_pos;
+        id = _text.substr(start, _pos - start);
+        if (id.empty() || _text.substr(_pos, 3) != " = ")
+            return false;
+        _pos += 3;
+        return true;
     }
-
-    template <class A> auto someP(std::function<A()> a) {
-        return [this, a]() {
-            vector<A> res;
-            res.push_back(a());
-            auto as = manyP(a)();
-            res.insert(res.end(), as.begin(), as.end());
-            return res;
-        };
-    }
-    auto stateNameP() {
-        return [this]() -> string {
-            try {
-                auto v = someP<char>(predP(isStateChar))();
-                return {v.begin(), v.end()};
-            } catch (ParseError) {
-                throw_("Expecting legal state name");
-                assert(0);
-            }
-        };
-    }
-    auto lineStartP() const {
-        return [this]() -> void {
-            if (_loc.col != 1) {
-                throw_("Should be at beginning of line");
+    // whitespace till line break or eof
+    bool defEnd() {
+        bool commented = false;
+        while (!isEof()) {
+            auto c = peek();
+            if (c == '\n') {
+                break;
+            } else if ((commented |= (c == ';'))) {
+                ;
+            } else if (!std::isspace((unsigned char)c)) {
+                return fail(string("Extra ") + c + " before newline");
             }
-        };
-    }
-    auto defBeginP() {
-        return [this]() -> string {
-            skipWs()();
-            lineStartP()();
-            charP('#')();
-            auto id = someP<char>(predP(isalnum))();
-            exactP(" = ")();
-            return {id.begin(), id.end()};
-        };
-    }
-    void defBeginOfP(string s) {
-        auto t = defBeginP()();
-        if (s != t) {
-            throw_(string("Expecting definition of ") + s + " but got " + t);
+            ++_pos;
         }
+        return true;
     }
-    // whitespace till line break or eof
-    auto defEndP() {
-        return [this]() -> void {
-            bool commented = false;
-            while (!isEof()) {
-                auto c = peekP()();
-                if (c == '\n') {
-                    break;
-                } else if ((commented |= (c == ';'))) {
-                    ;
-                } else if (!isspace(c)) {
-                    throw_(string("Extra ") + c + " before newline");
-                }
-                advance();
+    template <class Set, class Atom>
+    bool set(bool (TmParser::*atom)(Atom &), Set &res) {
+        Atom a;
+        if (!expect('{') || !(this->*atom)(a))
+            return false;
+        res.insert(a);
+        while (!isEof() && peek() == ',') {
+            const auto save = _pos++;
+            if (!(this->*atom)(a)) {
+                _pos = save;
+                break;
             }
-        };
+            res.insert(a);
+        }
+        return expect('}');
     }
-    template <class Atom> auto setP(std::function<Atom()> atom) {
-        return [this, atom]() {
-            auto oldloc = _loc;
-            unordered_set<Atom> res;
-            try {
-                exactP("{")();
-                res.insert(atom());
-                while (auto s = tryP<Atom>([this, atom]() {
-                           charP(',')();
-                           return atom();
-                       })()) {
-                    res.insert(s.getR());
-                }
-                exactP("}")();
-                return res;
-            } catch (ParseError e) {
-                _loc = oldloc;
-                throw e;
-            }
-        };
+    bool inputAtom(char &c) { return one(isInputChar, c); }
+    bool tapeAtom(char &c) { return one(isTapeChar, c); }
+    bool number(uint32_t &res) {
+        string_view digits;
+        if (!some([](char c) { return std::isdigit((unsigned char)c); },
+                  digits))
+            return false;
+        uint64_t v = 0;
+        for (auto c : digits) {
+            v = v * 10 + (c - '0');
+            if (v > INT32_MAX)
+                break;
+        }
+        if (v == 0 || v > INT32_MAX)
+            return fail(string("Not a positive integer: ") + string(digits));
+        res = v;
+        return true;
     }
 
-    auto qP() { return setP<string>(stateNameP()); }
-
-    auto sP() { return setP<char>(predP(isInputChar)); }
-
-    auto gP() { return setP<char>(predP(isTapeChar)); }
-
-    auto q0P() { return stateNameP(); }
-
-    auto bP() { return predP(isTapeChar); }
-
-    auto fP() { return setP<string>(stateNameP()); }
-
-    auto nP() {
-        return [this]() {
-            auto chars = someP<char>(predP(isdigit))();
-            string s = {chars.begin(), chars.end()};
-            bool error = false;
-            int v;
-            try {
-                v = std::stoi(s);
-            } catch (...) {
-                error = true;
-            }
-            if (v <= 0) {
-                error = true;
-            }
-            if (error) {
-                throw_(string("Not a positive integer: ") + s);
-            }
-            return v;
-        };
+    bool rule(DRule &r) {
+        string_view blanks;
+        skipWs();
+        if (!lineStart())
+            return fail("Should be at beginning of line");
+        if (!stateName(r.src) || !some(isBlank, blanks) ||
+            !some(isTapeChar, r.get) || !some(isBlank, blanks) ||
+            !some(isTapeChar, r.put) || !some(isBlank, blanks))
+            return false;
+        if (!isEof() && !isDirChar(peek()))
+            return fail(string("Expecting any char in lr* but got ") + peek());
+        if (!some(isDirChar, r.dirs))
+            return false;
+        while (!isEof() && isBlank(peek()))
+            ++_pos;
+        return stateName(r.dst);
     }
 
-    auto ruleP() {
-        return [this]() {
-            skipWs()();
-            lineStartP()();
-            auto curState = stateNameP()();
-            someP<char>(predP(isblank))();
-            auto getSymb = someP<char>(predP(isTapeChar))();
-            someP<char>(predP(isblank))();
-            auto putSymb = someP<char>(predP(isTapeChar))();
-            someP<char>(predP(isblank))();
-            auto dirs = someP<Dir>([this]() {
-                auto c = anyP("lr*")();
-                if (c == 'l') {
-                    return L;
-                } else if (c == 'r') {
-                    return R;
-                } else if (c == '*') {
-                    return N;
-                } else {
-                    assert(0);
-                }
-            })();
-            manyP<char>(predP(isblank))();
-            auto nextState = stateNameP()();
-            return std::make_tuple(curState, getSymb, nextState, putSymb, dirs);
-        };
+    bool definition(string_view s) {
+        if (s == "Q") {
+            StateList q;
+            if (!set(&TmParser::stateAtom, q))
+                return false;
+            if (_Q.has_value())
+                return fail("Redefinition of Q");
+            _Q = std::move(q);
+        } else if (s == "S") {
+            Alphabet s;
+            if (!set(&TmParser::inputAtom, s))
+                return false;
+            if (_S.has_value())
+                return fail("Redefinition of S");
+            _S = std::move(s);
+        } else if (s == "G") {
+            Alphabet g;
+            if (!set(&TmParser::tapeAtom, g))
+                return false;
+            if (_G.has_value())
+                return fail("Redefinition of G");
+            _G = std::move(g);
+        } else if (s == "q0") {
+            string q0;
+            if (!stateAtom(q0))
+                return false;
+            if (_q0.has_value())
+                return fail("Redefinition of q0");
+            _q0 = q0;
+        } else if (s == "B") {
+            char b;
+            if (!tapeAtom(b))
+                return false;
+            if (_B.has_value())
+                return fail("Redefinition of B");
+            _B = b;
+        } else if (s == "F") {
+            StateList f;
+            if (!set(&TmParser::stateAtom, f))
+                return false;
+            if (_F.has_value())
+                return fail("Redefinition of F");
+            _F = std::move(f);
+        } else if (s == "N") {
+            uint32_t n;
+            if (!number(n))
+                return false;
+            if (_N.has_value())
+                return fail("Redefinition of N");
+            _N = n;
+        } else {
+            return fail(string("Unknown component of TM: ") + string(s));
+        }
+        return true;
     }
 
-    void run() {
+    bool run() {
         while (!isEof()) {
-            if (auto def = tryP<string>(defBeginP())()) {
-                auto s = def.getR();
-                if (s == "Q") {
-                    auto q = qP()();
-                    throw_if(_Q.has_value(), "Redefinition of Q");
-                    _Q = q;
-                } else if (s == "S") {
-                    auto s = sP()();
-                    throw_if(_S.has_value(), "Redefinition of S");
-                    _S = s;
-                } else if (s == "G") {
-                    auto g = gP()();
-                    throw_if(_G.has_value(), "Redefinition of G");
-                    _G = g;
-                } else if (s == "q0") {
-                    auto q0 = q0P()();
-                    throw_if(_q0.has_value(), "Redefinition of q0");
-                    _q0 = q0;
-                } else if (s == "B") {
-                    auto b = bP()();
-                    throw_if(_B.has_value(), "Redefinition of B");
-                    _B = b;
-                } else if (s == "F") {
-                    auto f = fP()();
-                    throw_if(_F.has_value(), "Redefinition of F");
-                    _F = f;
-                } else if (s == "N") {
-                    auto n = nP()();
-                    throw_if(_N.has_value(), "Redefinition of N");
-                    _N = n;
-                } else {
-                    throw_(string("Unknown component of TM: ") + s);
-                }
-                defEndP()();
+            const auto start = _pos;
+            string_view def;
+            DRule d;
+            if (defBegin(def)) {
+                if (!definition(def))
+                    return false;
+            } else if (_pos = start, rule(d)) {
+                _delta.push_back(d);
             } else {
-                auto d = tryP<DRule>(ruleP())();
-                if (d) {
-                    _delta.push_back(d.getR());
-                } else {
-                    try {
-                        skipWs()();
-                        eofP()();
-                    } catch (ParseError) {
-                        auto e = d.getL();
-                        e.msg = "In parsing transition rule: " + e.msg;
-                        throw e;
-                    }
+                // Only whitespace and comments may be left.
+                const auto errPos = _errPos;
+                _pos = start;
+                skipWs();
+                if (!isEof()) {
+                    _errPos = errPos;
+                    _errMsg = "In parsing transition rule: " + _errMsg;
+                    return false;
                 }
-                defEndP()();
             }
+            if (!defEnd())
+                return false;
         }
 
         if (!_Q.has_value())
-            throw_("No definition of Q");
+            return fail("No definition of Q");
         if (!_S.has_value())
-            throw_("No definition of S");
+            return fail("No definition of S");
         if (!_G.has_value())
-            throw_("No definition of G");
+            return fail("No definition of G");
         if (!_q0.has_value())
-            throw_("No definition of q0");
+            return fail("No definition of q0");
         if (!_B.has_value())
-            throw_("No definition of B");
+            return fail("No definition of B");
         if (!_F.has_value())
-            throw_("No definition of F");
+            return fail("No definition of F");
         if (!_N.has_value())
-            throw_("No definition of N");
+            return fail("No definition of N");
+        return true;
     }
 
     TapeChar toTapeChar(char c) const {
@@ -443,44 +378,54 @@ class TmParser {
   public:
     TmParser() {}
 
-    Either<ParseError, Tm> parse(string text) {
+    Either<ParseError, Tm> parse(string_view text, ParseTimes *times) {
+        const auto start = std::chrono::steady_clock::now();
         init(text);
-        try {
-            run();
-        } catch (ParseError e) {
-            return Either<ParseError, Tm>::inl(e);
+        if (!run()) {
+            return Either<ParseError, Tm>::inl(
+                ParseError{_errMsg, {locationOf(_errPos)}});
         }
         // TODO: catch errors here
         try {
             auto builder = TmBuilder::withTapes(_N.value());
-            for (auto q : _Q.value()) {
+            for (const auto &q : _Q.value()) {
                 builder.addState(q);
             }
-            for (auto s : _S.value()) {
+            for (auto s : _S.value().symbols()) {
                 builder.addInputSymbol(s);
             }
-            for (auto g : _G.value()) {
+            for (auto g : _G.value().symbols()) {
                 builder.addTapeSymbol(g);
             }
             builder.makeInitial(_q0.value());
-            for (auto f : _F.value()) {
+            for (const auto &f : _F.value()) {
                 builder.makeFinal(f);
             }
             builder.setBlankChar(_B.value());
-            for (auto r : _delta) {
-                auto curState = std::get<0>(r), nextState = std::get<2>(r);
-                vector<TapeChar> getSymb, putSymb;
-                std::transform(std::get<1>(r).begin(), std::get<1>(r).end(),
-                               std::back_inserter(getSymb),
-                               [this](char c) { return toTapeChar(c); });
-                std::transform(std::get<3>(r).begin(), std::get<3>(r).end(),
-                               std::back_inserter(putSymb),
-                               [this](char c) { return toTapeChar(c); });
-                auto dirs = std::get<4>(r);
-                builder.addTransition(curState, getSymb, nextState, putSymb,
-                                      dirs);
+            vector<TapeChar> getSymb, putSymb;
+            vector<Dir> dirs;
+            for (const auto &r : _delta) {
+                getSymb.clear();
+                putSymb.clear();
+                dirs.clear();
+                for (auto c : r.get)
+                    getSymb.push_back(toTapeChar(c));
+                for (auto c : r.put)
+                    putSymb.push_back(toTapeChar(c));
+                for (auto c : r.dirs)
+                    dirs.push_back(c == 'l' ? L : c == 'r' ? R : N);
+                builder.addTransition(r.src, getSymb, r.dst, putSymb, dirs);
+            }
+            const auto built = std::chrono::steady_clock::now();
+            auto tm = builder.build();
+            if (times) {
+                const auto end = std::chrono::steady_clock::now();
+                times->parse =
+                    std::chrono::duration<double>(built - start).count();
+                times->build =
+                    std::chrono::duration<double>(end - built).count();
             }
-            return Either<ParseError, Tm>::inr(builder.build());
+            return Either<ParseError, Tm>::inr(std::move(tm));
         } catch (TmBuilderError e) {
             return Either<ParseError, Tm>::inl(
                 ParseError{string("Error when building TM: ") + e.msg,
@@ -489,4 +434,6 @@ class TmParser {
     }
 };
 
-Either<ParseError, Tm> parseTm(string text) { return TmParser().parse(text); }
+Either<ParseError, Tm> parseTm(string_view text, ParseTimes *times) {
+    return TmParser().parse(text, times);
+}
@@ -3,7 +3,8 @@
 #define _FLA_PARSER_H
 #include "tm.h"
 #include "utils.h"
-using std::ptrdiff_t;
+#include <string_view>
+using std::ptrdiff_t, std::string_view;
 struct Location {
     ptrdiff_t off, line, col;
     void advance(bool newline);
@@ -16,5 +17,10 @@ struct ParseError {
     operator string() const;
 };
 
-Either<ParseError, Tm> parseTm(string);
+// Seconds spent reading the text and building the machine from it.
+struct ParseTimes {
+    double parse = 0, build = 0;
+};
+
+Either<ParseError, Tm> parseTm(string_view, ParseTimes *times = nullptr);
 #endif
@@ -0,0 +1,99 @@
+#include "profile.h"
+#include <algorithm>
+#include <cstdio>
+
+Profiler::Profiler(const Tm &tm, const Id &id)
+    : _tm(tm), _stateSteps(tm.stateCount()), _ruleSteps(tm.ruleCount()),
+      _low(tm.tapeCount()), _high(tm.tapeCount()) {
+    for (uint32_t i = 0; i < tm.tapeCount(); ++i)
+        _low[i] = _high[i] = id.position(i);
+}
+
+uint64_t Profiler::run(Id &id, uint64_t maxSteps) {
+    const auto tapes = _tm.tapeCount();
+    uint64_t steps = 0;
+    while (steps < maxSteps) {
+        const auto r = _tm.match(id);
+        if (r < 0)
+            break;
+        ++_stateSteps[id.state()];
+        ++_ruleSteps[r];
+        _tm.apply(id, r);
+        for (uint32_t i = 0; i < tapes; ++i) {
+            const auto pos = id.position(i);
+            _low[i] = std::min(_low[i], pos);
+            _high[i] = std::max(_high[i], pos);
+        }
+        ++steps;
+    }
+    return steps;
+}
+
+// Indices of the nonzero counts, largest first.
+static vector<uint32_t> ranked(const vector<uint64_t> &counts) {
+    vector<uint32_t> res;
+    for (uint32_t k = 0; k < counts.size(); ++k)
+        if (counts[k])
+            res.push_back(k);
+    std::stable_sort(res.begin(), res.end(), [&counts](uint32_t a, uint32_t b) {
+        return counts[a] > counts[b];
+    });
+    return res;
+}
+
+static string symbol(int16_t c) { return string(1, c < 0 ? '*' : (char)c); }
+
+// Prints count and its share of total in fixed columns, then the label.
+static void row(std::ostream &out, uint64_t count, uint64_t total,
+                const string &label) {
+    char buf[48];
+    std::snprintf(buf, sizeof buf, "%14llu %6.2f%%  ",
+                  (unsigned long long)count, 100.0 * count / total);
+    out << buf << label << '\n';
+}
+
+void Profiler::report(std::ostream &out, size_t top) const {
+    uint64_t total = 0;
+    for (auto n : _stateSteps)
+        total += n;
+    out << "Steps   : " << total << '\n';
+    if (!total)
+        return;
+
+    const auto states = ranked(_stateSteps);
+    out << "States  :\n";
+    for (size_t k = 0; k < states.size() && k < top; ++k)
+        row(out, _stateSteps[states[k]], total, _tm.stateName(states[k]));
+    if (states.size() > top)
+        out << "  (" << states.size() - top << " more)\n";
+
+    vector<StateIdx> src(_tm.ruleCount());
+    for (StateIdx s = 0; s < _tm.stateCount(); ++s) {
+        const auto rules = _tm.stateRules(s);
+        for (auto *r = rules.first; r != rules.second; ++r)
+            src[*r] = s;
+    }
+    const auto rules = ranked(_ruleSteps);
+    const auto tapes = _tm.tapeCount();
+    out << "Rules   :\n";
+    for (size_t k = 0; k < rules.size() && k < top; ++k) {
+        const auto r = rules[k];
+        // As written in the .tm file.
+        string old, put, dirs;
+        for (uint32_t i = 0; i < tapes; ++i) {
+            old += symbol(_tm.ruleGet(r)[i]);
+            put += symbol(_tm.rulePut(r)[i]);
+            const auto d = _tm.ruleDirs(r)[i];
+            dirs += d == L ? 'l' : d == R ? 'r' : '*';
+        }
+        row(out, _ruleSteps[r], total,
+            _tm.stateName(src[r]) + ' ' + old + ' ' + put + ' ' + dirs + ' ' +
+                _tm.stateName(_tm.ruleDst(r)));
+    }
+    if (rules.size() > top)
+        out << "  (" << rules.size() - top << " more)\n";
+
+    out << "Cells   :\n";
+    for (uint32_t i = 0; i < tapes; ++i)
+        out << "  tape " << i << ": " << _low[i] << " to " << _high[i] << '\n';
+}
@@ -0,0 +1,24 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_PROFILE_H
+#define _FLA_PROFILE_H
+#include "tm.h"
+#include <ostream>
+
+// Counts the steps taken from every state and by every rule, in arrays
+// indexed by state and compiled rule, and the lowest and highest cell each
+// head visits.
+class Profiler {
+  private:
+    const Tm &_tm;
+    vector<uint64_t> _stateSteps, _ruleSteps;
+    vector<int32_t> _low, _high;
+
+  public:
+    // id is the configuration at step 0 of the run.
+    Profiler(const Tm &, const Id &);
+    // Like Tm::run, counting every step.
+    uint64_t run(Id &, uint64_t);
+    // Prints the top states and rules by steps, and the cells visited.
+    void report(std::ostream &, size_t top) const;
+};
+#endif
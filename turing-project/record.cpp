@@ -0,0 +1,328 @@
+#include "record.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Layout of a recording (.tmr file): a RecHeader, the body, an index of the
+// checkpoints and a RecTrailer. The body is a sequence of checkpoints, each
+// followed by the rules applied from its step on, as LEB128 numbers. A
+// checkpoint holds the state, then for every tape the head position, the
+// first non-blank cell, the number of cells that follow and the cells. The
+// index holds the step and the offset of every checkpoint. As in .tmb
+// files, integers are stored in the byte order of the writer.
+static const char TMR_MAGIC[4] = {'T', 'M', 'R', '\x1a'};
+static const uint32_t TMR_VERSION = 1;
+static const uint32_t TMR_BYTE_ORDER = 0x01020304;
+// A checkpoint file (.tmc) holds a CkpHeader and a single checkpoint laid
+// out as in a recording.
+static const char TMC_MAGIC[4] = {'T', 'M', 'C', '\x1a'};
+static const uint32_t TMC_VERSION = 1;
+// Least number of bytes of rules between two checkpoints.
+static const uint64_t CHECKPOINT_BYTES = 1 << 16;
+// Output is handed to the stream in pieces of about this size.
+static const size_t OUTPUT_CHUNK = 1 << 20;
+
+struct RecHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t tapeCount;
+    uint64_t machine;
+};
+
+struct RecTrailer {
+    uint64_t indexOffset, checkpoints, steps;
+    uint32_t halted;
+    char magic[4];
+};
+
+struct CkpHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t tapeCount;
+    uint64_t machine;
+    uint64_t steps;
+};
+
+template <class T> static void append(string &out, const T &v) {
+    out.append((const char *)&v, sizeof v);
+}
+
+static void appendVarint(string &out, uint64_t v) {
+    for (; v >= 0x80; v >>= 7)
+        out.push_back((char)(v | 0x80));
+    out.push_back((char)v);
+}
+
+template <class T> static T load(string_view data, uint64_t &pos) {
+    T v;
+    if (pos > data.size() || data.size() - pos < sizeof v)
+        throw RecordError{"Corrupt recording"};
+    std::memcpy(&v, data.data() + pos, sizeof v);
+    pos += sizeof v;
+    return v;
+}
+
+static uint64_t loadVarint(string_view data, uint64_t &pos) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (pos >= data.size())
+            break;
+        const auto b = (unsigned char)data[pos++];
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    throw RecordError{"Corrupt recording"};
+}
+
+Recorder::Recorder(const Tm &tm, const string &path, const Id &id)
+    : _tm(tm), _path(path), _out(path, std::ios::binary | std::ios::trunc),
+      _offset(0), _steps(0), _sinceCheckpoint(0), _checkpointDue(0) {
+    if (!_out)
+        throw RecordError{"Cannot write " + path};
+    RecHeader hdr{};
+    std::copy(TMR_MAGIC, TMR_MAGIC + 4, hdr.magic);
+    hdr.version = TMR_VERSION;
+    hdr.byteOrder = TMR_BYTE_ORDER;
+    hdr.tapeCount = tm.tapeCount();
+    hdr.machine = tm.hash();
+    append(_buf, hdr);
+    _checkpoint(id);
+}
+
+// Appends id as laid out in a checkpoint.
+static void appendId(string &out, const Id &id) {
+    append(out, (uint32_t)id.state());
+    for (uint32_t i = 0; i < id.tapeCount(); ++i) {
+        const auto bounds = id.nonBlankRange(i);
+        append(out, id.position(i));
+        append(out, bounds.first);
+        append(out, (uint32_t)(bounds.second - bounds.first));
+        out.append(id.contentsView(i));
+    }
+}
+
+// Reads an Id of tm written by appendId at pos, moving pos past it, for a
+// checkpoint taken after steps steps. Heads start at cell 0 and cells are
+// only written under a head, so the head and the first non-blank cell of a
+// tape lie at most steps cells from 0; farther ones, which would make the
+// run grow its buffer across the gap, are rejected. The cells of a tape are
+// placed as one block.
+static Id loadId(const Tm &tm, uint64_t steps, string_view data,
+                 uint64_t &pos) {
+    const auto corrupt = RecordError{"Corrupt recording"};
+    const auto far = [steps](int32_t cell) {
+        return (uint64_t)std::abs((int64_t)cell) > steps;
+    };
+    const auto state = load<uint32_t>(data, pos);
+    if (state >= tm.stateCount())
+        throw corrupt;
+    Id id(state, tm.tapeCount(), tm.blankChar(), "");
+    for (uint32_t i = 0; i < tm.tapeCount(); ++i) {
+        const auto head = load<int32_t>(data, pos);
+        const auto first = load<int32_t>(data, pos);
+        const auto len = load<uint32_t>(data, pos);
+        if (data.size() - pos < len || far(head))
+            throw corrupt;
+        const auto cells = data.substr(pos, len);
+        if (len && (far(first) || first == INT32_MIN ||
+                    (int64_t)first + len > INT32_MAX ||
+                    cells.front() == tm.blankChar() ||
+                    cells.back() == tm.blankChar()))
+            throw corrupt;
+        if (len)
+            id.contents(i, first, vector<char>(cells.begin(), cells.end()));
+        pos += len;
+        id.position(i, head);
+    }
+    return id;
+}
+
+void Recorder::_checkpoint(const Id &id) {
+    const auto start = _offset + _buf.size();
+    _index.emplace_back(_steps, start);
+    appendId(_buf, id);
+    _sinceCheckpoint = 0;
+    _checkpointDue =
+        std::max<uint64_t>(_offset + _buf.size() - start, CHECKPOINT_BYTES);
+}
+
+uint64_t Recorder::run(Id &id, uint64_t maxSteps) {
+    uint64_t steps = 0;
+    while (steps < maxSteps) {
+        const auto r = _tm.match(id);
+        if (r < 0)
+            break;
+        if (_sinceCheckpoint >= _checkpointDue)
+            _checkpoint(id);
+        const auto size = _buf.size();
+        appendVarint(_buf, r);
+        _sinceCheckpoint += _buf.size() - size;
+        _tm.apply(id, r);
+        ++_steps;
+        ++steps;
+        if (_buf.size() >= OUTPUT_CHUNK)
+            _drain();
+    }
+    return steps;
+}
+
+void Recorder::_drain() {
+    if (!_out.write(_buf.data(), _buf.size()))
+        throw RecordError{"Cannot write " + _path};
+    _offset += _buf.size();
+    _buf.clear();
+}
+
+void Recorder::finish(bool halted) {
+    RecTrailer trailer{};
+    trailer.indexOffset = _offset + _buf.size();
+    trailer.checkpoints = _index.size();
+    trailer.steps = _steps;
+    trailer.halted = halted;
+    std::copy(TMR_MAGIC, TMR_MAGIC + 4, trailer.magic);
+    for (const auto &entry : _index) {
+        append(_buf, entry.first);
+        append(_buf, entry.second);
+    }
+    append(_buf, trailer);
+    _drain();
+    if (!_out.flush())
+        throw RecordError{"Cannot write " + _path};
+}
+
+Replay::Replay(const Tm &tm, MappedFile file) : _tm(tm), _file(file) {
+    const auto data = _file.text();
+    uint64_t pos = 0;
+    const auto hdr = load<RecHeader>(data, pos);
+    if (!std::equal(TMR_MAGIC, TMR_MAGIC + 4, hdr.magic))
+        throw RecordError{"Not a recording"};
+    if (hdr.version != TMR_VERSION || hdr.byteOrder != TMR_BYTE_ORDER)
+        throw RecordError{"Unsupported recording format"};
+    if (hdr.tapeCount != tm.tapeCount() || hdr.machine != tm.hash())
+        throw RecordError{"Recording was made with another machine"};
+    if (data.size() < sizeof(RecHeader) + sizeof(RecTrailer))
+        throw RecordError{"Incomplete recording"};
+    pos = data.size() - sizeof(RecTrailer);
+    const auto trailer = load<RecTrailer>(data, pos);
+    if (!std::equal(TMR_MAGIC, TMR_MAGIC + 4, trailer.magic))
+        throw RecordError{"Incomplete recording"};
+    _steps = trailer.steps;
+    _halted = trailer.halted;
+    _checkpoints = trailer.checkpoints;
+    _indexOffset = trailer.indexOffset;
+    if (_checkpoints == 0 || _indexOffset > data.size() ||
+        (data.size() - sizeof(RecTrailer) - _indexOffset) / 16 !=
+            _checkpoints)
+        throw RecordError{"Corrupt recording"};
+}
+
+uint64_t Replay::steps() const { return _steps; }
+
+bool Replay::halted() const { return _halted; }
+
+Id Replay::at(uint64_t step) const {
+    const auto data = _file.text();
+    // The last checkpoint at or before step.
+    uint64_t lo = 0, hi = _checkpoints;
+    while (hi - lo > 1) {
+        const auto mid = (lo + hi) / 2;
+        uint64_t pos = _indexOffset + mid * 16;
+        if (load<uint64_t>(data, pos) <= step)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    uint64_t pos = _indexOffset + lo * 16;
+    const auto from = load<uint64_t>(data, pos);
+    pos = load<uint64_t>(data, pos);
+    if (from > step)
+        throw RecordError{"Corrupt recording"};
+    auto id = loadId(_tm, from, data, pos);
+    for (auto s = from; s < step; ++s) {
+        const auto r = loadVarint(data, pos);
+        if (r >= _tm.ruleCount() || pos > _indexOffset)
+            throw RecordError{"Corrupt recording"};
+        _tm.apply(id, r);
+    }
+    return id;
+}
+
+// Writes all of buf to fd and flushes it to the device.
+static bool writeSynced(int fd, string_view buf) {
+    while (!buf.empty()) {
+        const auto n = write(fd, buf.data(), buf.size());
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        buf.remove_prefix(n);
+    }
+    return fsync(fd) == 0;
+}
+
+// The file is written under a temporary name, synced and renamed over path,
+// and the directory is synced after the rename, so that an earlier
+// checkpoint survives an interrupted write or a crash of the host.
+void saveCheckpoint(const Tm &tm, const Id &id, uint64_t steps,
+                    const string &path) {
+    string buf;
+    CkpHeader hdr{};
+    std::copy(TMC_MAGIC, TMC_MAGIC + 4, hdr.magic);
+    hdr.version = TMC_VERSION;
+    hdr.byteOrder = TMR_BYTE_ORDER;
+    hdr.tapeCount = tm.tapeCount();
+    hdr.machine = tm.hash();
+    hdr.steps = steps;
+    append(buf, hdr);
+    appendId(buf, id);
+    const auto tmp = path + ".tmp";
+    const int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0)
+        throw RecordError{"Cannot write " + path};
+    const bool written = writeSynced(fd, buf);
+    if (close(fd) != 0 || !written ||
+        std::rename(tmp.c_str(), path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        throw RecordError{"Cannot write " + path};
+    }
+    const auto slash = path.rfind('/');
+    const auto dir = slash == string::npos ? string(".")
+                     : slash == 0          ? string("/")
+                                           : path.substr(0, slash);
+    const int dirFd = open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    const bool synced = dirFd >= 0 && fsync(dirFd) == 0;
+    if (dirFd >= 0)
+        close(dirFd);
+    if (!synced)
+        throw RecordError{"Cannot write " + path};
+}
+
+Id loadCheckpoint(const Tm &tm, const MappedFile &file, uint64_t &steps) {
+    const auto data = file.text();
+    uint64_t pos = 0;
+    if (data.size() < sizeof(CkpHeader))
+        throw RecordError{"Not a checkpoint"};
+    const auto hdr = load<CkpHeader>(data, pos);
+    if (!std::equal(TMC_MAGIC, TMC_MAGIC + 4, hdr.magic))
+        throw RecordError{"Not a checkpoint"};
+    if (hdr.version != TMC_VERSION || hdr.byteOrder != TMR_BYTE_ORDER)
+        throw RecordError{"Unsupported checkpoint format"};
+    if (hdr.tapeCount != tm.tapeCount() || hdr.machine != tm.hash())
+        throw RecordError{"Checkpoint was made with another machine"};
+    try {
+        auto id = loadId(tm, hdr.steps, data, pos);
+        if (pos != data.size())
+            throw RecordError{};
+        steps = hdr.steps;
+        return id;
+    } catch (RecordError) {
+        throw RecordError{"Corrupt checkpoint"};
+    }
+}
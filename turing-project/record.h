@@ -0,0 +1,65 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_RECORD_H
+#define _FLA_RECORD_H
+#include "tm.h"
+#include "utils.h"
+#include <fstream>
+
+struct RecordError {
+    string msg;
+};
+
+// Writes a recording of a run: the rule applied at every step, with a full
+// checkpoint of the Id every so often so that any step can be restored
+// without running the machine from the start. A checkpoint is taken once
+// the rules written since the last one take as many bytes as it did, but
+// at least every CHECKPOINT_BYTES, so the checkpoints at most double the
+// size of the file.
+class Recorder {
+  private:
+    const Tm &_tm;
+    string _path;
+    std::ofstream _out;
+    string _buf;
+    uint64_t _offset, _steps;
+    // Bytes of rules written since the last checkpoint, and when the next
+    // one is due.
+    uint64_t _sinceCheckpoint, _checkpointDue;
+    vector<pair<uint64_t, uint64_t>> _index;
+    void _checkpoint(const Id &);
+    void _drain();
+
+  public:
+    // Starts recording the run of tm from id into a new file at path.
+    Recorder(const Tm &, const string &path, const Id &);
+    // Like Tm::run, recording every step.
+    uint64_t run(Id &, uint64_t);
+    // Completes the file; halted tells whether the run has halted.
+    void finish(bool halted);
+};
+
+// A recording loaded from a file, for the machine it was made with.
+class Replay {
+  private:
+    const Tm &_tm;
+    MappedFile _file;
+    uint64_t _steps, _checkpoints, _indexOffset;
+    bool _halted;
+
+  public:
+    Replay(const Tm &, MappedFile);
+    // Number of steps recorded, and whether the run halted after them.
+    uint64_t steps() const;
+    bool halted() const;
+    // Restores the Id at the given step, which must be at most steps(), by
+    // replaying rules from the nearest checkpoint before it.
+    Id at(uint64_t) const;
+};
+
+// Writes a checkpoint of a run of tm to path: the Id reached after steps
+// steps, which is all a run needs to go on.
+void saveCheckpoint(const Tm &, const Id &, uint64_t steps,
+                    const string &path);
+// Restores a checkpoint made with tm, setting steps to its step count.
+Id loadCheckpoint(const Tm &, const MappedFile &, uint64_t &steps);
+#endif
@@ -0,0 +1,134 @@
+#include "rle.h"
+#include <algorithm>
+
+RleTape::RleTape(char blankChar, const string &input) : _blankChar(blankChar) {
+    for (auto it = input.rbegin(); it != input.rend(); ++it)
+        _push(_right, *it, 1);
+}
+
+// Adds n cells holding c next to the head on stack s.
+void RleTape::_push(vector<Block> &s, char c, uint64_t n) {
+    if (n == 0)
+        return;
+    if (!s.empty() && s.back().c == c)
+        s.back().len += n;
+    else if (!s.empty() || c != _blankChar)
+        s.push_back({c, n});
+}
+
+// Removes the n cells next to the head on stack s, which must all lie in its
+// back block (or beyond its front, where there is nothing to remove).
+void RleTape::_take(vector<Block> &s, uint64_t n) {
+    if (s.empty() || n == 0)
+        return;
+    if (n >= s.back().len)
+        s.pop_back();
+    else
+        s.back().len -= n;
+}
+
+char RleTape::get() const {
+    return _right.empty() ? _blankChar : _right.back().c;
+}
+
+// Returns the number of cells, starting from the one under the head and
+// going in direction dir, that hold the same symbol.
+uint64_t RleTape::run(Dir dir) const {
+    if (dir == R)
+        return _right.empty() ? INF : _right.back().len;
+    const char c = get();
+    if (_left.empty())
+        return c == _blankChar ? INF : 1;
+    return _left.back().c == c ? _left.back().len + 1 : 1;
+}
+
+void RleTape::put(char c) {
+    _take(_right, 1);
+    _push(_right, c, 1);
+}
+
+// Writes c to the n cells starting under the head in direction dir, moving
+// the head past them. n must not exceed run(dir).
+void RleTape::sweep(Dir dir, uint64_t n, char c) {
+    if (dir == R) {
+        _take(_right, n);
+        _push(_left, c, n);
+    } else if (dir == L) {
+        _take(_right, 1);
+        _take(_left, n - 1);
+        _push(_right, c, n);
+        const char next = _left.empty() ? _blankChar : _left.back().c;
+        _take(_left, 1);
+        _push(_right, next, 1);
+    } else {
+        put(c);
+    }
+}
+
+// Same as Id::contents().
+string RleTape::contents() const {
+    string res;
+    for (const auto &b : _left)
+        res.append(b.len, b.c);
+    for (auto it = _right.rbegin(); it != _right.rend(); ++it)
+        res.append(it->len, it->c);
+    const auto lo = res.find_first_not_of(_blankChar);
+    if (lo == res.npos)
+        return "";
+    return res.substr(lo, res.find_last_not_of(_blankChar) + 1 - lo);
+}
+
+RleId::RleId(const Tm &tm, const string &input)
+    : _state(tm.initialState()),
+      _tapes(tm.tapeCount(), RleTape(tm.blankChar(), "")) {
+    if (!tm.validate(input))
+        throw TmError{"Not a valid input"};
+    _tapes.at(0) = RleTape(tm.blankChar(), input);
+}
+
+StateIdx RleId::state() const { return _state; }
+
+uint32_t RleId::tapeCount() const { return _tapes.size(); }
+
+int32_t RleId::match(const Tm &tm) const {
+    vector<char> read;
+    for (const auto &t : _tapes)
+        read.push_back(t.get());
+    return tm.match(_state, read.data());
+}
+
+string RleId::contents(uint32_t N) const { return _tapes.at(N).contents(); }
+
+// Runs at most maxSteps steps of tm on id and returns the number executed,
+// like Tm::run(). Whenever a rule loops back to its own state, the moving
+// heads sit on runs of identical symbols and the other heads keep reading
+// the same symbol, the rule keeps matching until one of the runs ends; all
+// those steps are applied at once.
+uint64_t runMacro(const Tm &tm, RleId &id, uint64_t maxSteps) {
+    const uint32_t tapes = id.tapeCount();
+    vector<char> read(tapes), write(tapes);
+    uint64_t steps = 0;
+    while (steps < maxSteps) {
+        for (uint32_t i = 0; i < tapes; ++i)
+            read[i] = id._tapes[i].get();
+        const auto r = tm.match(id._state, read.data());
+        if (r < 0)
+            break;
+        const auto dst = tm.ruleDst(r);
+        const auto *put = tm.rulePut(r);
+        const auto *dirs = tm.ruleDirs(r);
+        uint64_t n = dst == id._state ? maxSteps - steps : 1;
+        for (uint32_t i = 0; i < tapes; ++i) {
+            write[i] = put[i] < 0 ? read[i] : (char)put[i];
+            if (dirs[i] != N)
+                n = std::min(n, id._tapes[i].run(dirs[i]));
+            else if (write[i] != read[i])
+                n = 1;
+        }
+        for (uint32_t i = 0; i < tapes; ++i)
+            id._tapes[i].sweep(dirs[i], dirs[i] == N ? 1 : n, write[i]);
+        id._state = dst;
+        steps += n;
+    }
+    return steps;
+}
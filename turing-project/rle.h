@@ -0,0 +1,47 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_RLE_H
+#define _FLA_RLE_H
+#include "tm.h"
+
+// A tape stored as runs of identical symbols, split at the head into two
+// stacks of blocks whose backs are nearest to the head. The back of _right
+// starts at the cell under the head. Cells beyond the front of either stack
+// are blank, and a front block is never blank.
+class RleTape {
+  private:
+    struct Block {
+        char c;
+        uint64_t len;
+    };
+    vector<Block> _left, _right;
+    char _blankChar;
+    void _push(vector<Block> &, char, uint64_t);
+    static void _take(vector<Block> &, uint64_t);
+
+  public:
+    static const uint64_t INF = UINT64_MAX;
+    RleTape(char, const string &);
+    char get() const;
+    uint64_t run(Dir) const;
+    void put(char);
+    void sweep(Dir, uint64_t, char);
+    string contents() const;
+};
+
+// An instantaneous description whose tapes are RleTapes.
+class RleId {
+  private:
+    StateIdx _state;
+    vector<RleTape> _tapes;
+
+  public:
+    RleId(const Tm &, const string &);
+    StateIdx state() const;
+    uint32_t tapeCount() const;
+    int32_t match(const Tm &) const;
+    string contents(uint32_t) const;
+    friend uint64_t runMacro(const Tm &, RleId &, uint64_t);
+};
+
+uint64_t runMacro(const Tm &, RleId &, uint64_t);
+#endif
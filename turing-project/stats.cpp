@@ -0,0 +1,172 @@
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// The counters form one group, led by the cycle counter, so that they are
+// scheduled together. They are all dropped if any cannot be opened, as in
+// most containers and virtual machines.
+PerfCounters::PerfCounters() {
+    _fd.fill(-1);
+#ifdef __linux__
+    static const uint64_t config[COUNT] = {PERF_COUNT_HW_CPU_CYCLES,
+                                           PERF_COUNT_HW_INSTRUCTIONS,
+                                           PERF_COUNT_HW_CACHE_MISSES};
+    for (int k = 0; k < COUNT; ++k) {
+        perf_event_attr attr{};
+        attr.size = sizeof attr;
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = config[k];
+        attr.disabled = k == 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        _fd[k] = syscall(SYS_perf_event_open, &attr, 0, -1, k ? _fd[0] : -1,
+                         0);
+        if (_fd[k] < 0) {
+            for (int i = 0; i < k; ++i)
+                close(_fd[i]);
+            _fd.fill(-1);
+            return;
+        }
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (auto fd : _fd)
+        if (fd >= 0)
+            close(fd);
+#endif
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    if (_fd[0] < 0)
+        return;
+    ioctl(_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+}
+
+optional<PerfCounters::Counts> PerfCounters::stop() {
+#ifdef __linux__
+    if (_fd[0] < 0)
+        return std::nullopt;
+    ioctl(_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    Counts res;
+    for (int k = 0; k < COUNT; ++k)
+        if (read(_fd[k], &res[k], sizeof res[k]) != sizeof res[k])
+            return std::nullopt;
+    return res;
+#else
+    return std::nullopt;
+#endif
+}
+
+static double cpuSeconds() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+RunResult runCounted(const Tm &tm, Id id, const RunLimits &limits,
+                     RunStats &stats) {
+    HeadCounters heads(id);
+    size_t bytes = id.tapeBytes();
+    PerfCounters perf;
+    const auto wallStart = std::chrono::steady_clock::now();
+    const auto cpuStart = cpuSeconds();
+    perf.start();
+    auto res = runSteps(
+        tm, std::move(id),
+        [&](Id &id, uint64_t n) {
+            const auto done = tm.run(id, n, heads);
+            bytes = id.tapeBytes();
+            return done;
+        },
+        limits);
+    stats.perf = perf.stop();
+    stats.cpuSeconds = cpuSeconds() - cpuStart;
+    stats.wallSeconds = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - wallStart)
+                            .count();
+    stats.steps = res.steps;
+    stats.low = std::move(heads.low);
+    stats.high = std::move(heads.high);
+    stats.travel = std::move(heads.travel);
+    stats.tapeBytes = bytes;
+    return res;
+}
+
+static string fixed(double x, int digits) {
+    char buf[64];
+    std::snprintf(buf, sizeof buf, "%.*f", digits, x);
+    return buf;
+}
+
+// Prints one figure per line, or a single JSON object, with times in
+// seconds except for parsing and building, which are in milliseconds.
+void writeStats(std::ostream &out, const RunStats &stats,
+                StatsFormat format) {
+    const uint64_t rate =
+        stats.wallSeconds > 0 ? stats.steps / stats.wallSeconds : 0;
+    static const char *const perfNames[PerfCounters::COUNT][2] = {
+        {"Cycles      : ", "cycles"},
+        {"Instructions: ", "instructions"},
+        {"Cache misses: ", "cache_misses"}};
+    if (format == StatsFormat::Human) {
+        out << "Steps       : " << stats.steps
+            << "\nWall time   : " << fixed(stats.wallSeconds, 6) << " s"
+            << "\nCPU time    : " << fixed(stats.cpuSeconds, 6) << " s"
+            << "\nSteps/s     : " << rate
+            << "\nParse time  : " << fixed(stats.parseSeconds * 1000, 3)
+            << " ms\nBuild time  : " << fixed(stats.buildSeconds * 1000, 3)
+            << " ms\nTape memory : " << stats.tapeBytes << " bytes\n";
+        for (size_t i = 0; i < stats.low.size(); ++i) {
+            auto label = "Tape " + std::to_string(i);
+            label.resize(std::max<size_t>(label.size(), 12), ' ');
+            out << label << ": head range " << stats.low[i] << " to "
+                << stats.high[i] << ", "
+                << stats.high[i] - (int64_t)stats.low[i] + 1 << " cells, "
+                << stats.travel[i] << " moves\n";
+        }
+        if (!stats.perf) {
+            out << "Counters    : unavailable\n";
+        } else {
+            for (int k = 0; k < PerfCounters::COUNT; ++k)
+                out << perfNames[k][0] << (*stats.perf)[k] << '\n';
+        }
+        out.flush();
+        return;
+    }
+    out << "{\"steps\": " << stats.steps
+        << ", \"wall_seconds\": " << fixed(stats.wallSeconds, 6)
+        << ", \"cpu_seconds\": " << fixed(stats.cpuSeconds, 6)
+        << ", \"steps_per_second\": " << rate
+        << ", \"parse_ms\": " << fixed(stats.parseSeconds * 1000, 3)
+        << ", \"build_ms\": " << fixed(stats.buildSeconds * 1000, 3)
+        << ", \"tape_bytes\": " << stats.tapeBytes << ", \"tapes\": [";
+    for (size_t i = 0; i < stats.low.size(); ++i)
+        out << (i ? ", " : "") << "{\"low\": " << stats.low[i]
+            << ", \"high\": " << stats.high[i]
+            << ", \"head_cells\": " << stats.high[i] - (int64_t)stats.low[i] + 1
+            << ", \"travel\": " << stats.travel[i] << "}";
+    out << "], \"perf\": ";
+    if (!stats.perf) {
+        out << "null";
+    } else {
+        for (int k = 0; k < PerfCounters::COUNT; ++k)
+            out << (k ? ", \"" : "{\"") << perfNames[k][1]
+                << "\": " << (*stats.perf)[k];
+        out << "}";
+    }
+    out << "}" << std::endl;
+}
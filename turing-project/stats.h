@@ -0,0 +1,48 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_STATS_H
+#define _FLA_STATS_H
+#include "batch.h"
+#include "tm.h"
+#include <array>
+#include <ostream>
+
+// Hardware counters of the calling thread, read through perf_event_open
+// where the kernel allows it.
+class PerfCounters {
+  public:
+    enum { Cycles, Instructions, CacheMisses, COUNT };
+    using Counts = std::array<uint64_t, COUNT>;
+
+  private:
+    std::array<int, COUNT> _fd;
+
+  public:
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters &) = delete;
+    PerfCounters &operator=(const PerfCounters &) = delete;
+    void start();
+    // The counts since start(), or nothing if they are unavailable.
+    optional<Counts> stop();
+};
+
+// The figures reported by --stats.
+struct RunStats {
+    uint64_t steps = 0;
+    double wallSeconds = 0, cpuSeconds = 0;
+    double parseSeconds = 0, buildSeconds = 0;
+    // Per tape, as kept by Tm::run.
+    vector<int32_t> low, high;
+    vector<uint64_t> travel;
+    // Bytes held by the tapes at the end of the run, their peak.
+    size_t tapeBytes = 0;
+    optional<PerfCounters::Counts> perf;
+};
+
+enum class StatsFormat { Human, Json };
+
+// Runs id as runId does without macro steps, cycle detection or the JIT,
+// filling in the run figures of stats.
+RunResult runCounted(const Tm &, Id, const RunLimits &, RunStats &stats);
+void writeStats(std::ostream &, const RunStats &, StatsFormat);
+#endif
@@ -25,6 +25,13 @@ function test_errors {
         actual=$(./turing ./tests/1.a.tm "$s" 2>&1 >/dev/null) && die "Expected false return value for $TM"
         expect_eq "$expected" "$actual"
     done
+    # Long inputs are checked in blocks; the bad symbol may fall anywhere.
+    for n in 15 16 17 63 64 65 130; do
+        s=$(printf 'ab%.0s' $(seq $n))
+        actual=$(./turing -v ./tests/1.a.tm "${s:0:$n}B$s" 2>&1 >/dev/null | grep -n '\^')
+        expect_eq "5:$(printf ' %.0s' $(seq $((n + 7))))^" "$actual" "bad symbol after $n"
+        ./turing ./tests/1.a.tm "$s$s" &> /dev/null || die "Expected $s$s to be legal"
+    done
     for s in "a" "_" " "; do
         expected="illegal input"
         actual=$(./turing ./tests/2.a.tm "$s" 2>&1 >/dev/null) && die "Expected false return value for $TM"
@@ -130,7 +137,409 @@ function test_gcd {
     echo "GCD tests passed."
 }
 
+function test_limits {
+    echo "Testing step and time limits."
+    local TM=../programs/gcd.tm
+    # gcd.tm never finds the separator in an empty input
+    ./turing --max-steps 1000 "$TM" "" &> /dev/null
+    expect_eq 2 $? "--max-steps exit status"
+    actual=$(./turing --max-steps 1000 "$TM" "" 2>&1 | grep '^Steps')
+    expect_eq "Steps   : 1000" "$actual" "--max-steps summary"
+    ./turing --timeout 0.2 "$TM" "" &> /dev/null
+    expect_eq 2 $? "--timeout exit status"
+    actual=$(./turing --max-steps 100000 "$TM" 1101)
+    expect_eq 1 "$actual" "--max-steps on a halting run"
+    for opt in "--max-steps x" "--max-steps -1" "--timeout -1"; do
+        ./turing $opt "$TM" 101 &> /dev/null && die "Expecting false return value for $opt"
+    done
+    echo "Limit tests passed."
+}
+
+function test_macro {
+    echo "Testing macro-step engine."
+    for args in "../programs/gcd.tm 1111110111111111" "../programs/gcd.tm 11101" \
+                "../programs/is_sqrt.tm 1111111111111111" \
+                "tests/palindrome_detector_2tapes.tm 1101011" \
+                "tests/palindrome_detector_2tapes.tm 10"; do
+        for budget in "" "--max-steps 7" "--max-steps 50"; do
+            expected=$(./turing $budget $args 2>&1)
+            actual=$(./turing --macro $budget $args 2>&1)
+            expect_eq "$expected" "$actual" "--macro $budget $args"
+        done
+    done
+    echo "Macro-step tests passed."
+}
+
+function test_batch {
+    echo "Testing batch mode."
+
+    function replicate {
+        for ((i=0; i<$1; ++i)); do
+            echo -n $2
+        done
+    }
+
+    local TM=../programs/gcd.tm
+    local inputs="1101 11110111111 0 2 1"
+    expected=""
+    for s in $inputs; do
+        expected+="$(./turing --max-steps 5000 "$TM" "$s" 2>/dev/null)|"
+    done
+    actual=$(tr ' ' '\n' <<< "$inputs" | ./turing --max-steps 5000 --batch - "$TM" | cut -f1 | tr '\n' '|')
+    expect_eq "$expected" "$actual" "--batch contents"
+    actual=$(printf '1101\n2\n1\n' | ./turing --max-steps 5000 --batch - "$TM" | cut -f4 | tr '\n' ' ')
+    expect_eq "accept illegal limit " "$actual" "--batch status"
+    local inputs=""
+    for ((k=0; k<300; ++k)); do
+        inputs+="$(replicate $((RANDOM % 40)) 1)0$(replicate $((RANDOM % 40)) 1)"$'\n'
+    done
+    expected=$(./turing --max-steps 100000 --batch - "$TM" <<< "$inputs")
+    actual=$(./turing -j 4 --max-steps 100000 --batch - "$TM" <<< "$inputs")
+    expect_eq "$expected" "$actual" "-j 4 --batch"
+    ./turing -j 2 "$TM" 101 &> /dev/null && die "Expecting false return value for -j without --batch"
+    echo "Batch tests passed."
+}
+
+function test_compile {
+    echo "Testing compiled machines."
+    local TMB
+    TMB=$(mktemp --suffix=.tmb)
+    for args in "../programs/gcd.tm 1111110111111111" "../programs/is_sqrt.tm 111111111" \
+                "tests/palindrome_detector_2tapes.tm 1101011"; do
+        set -- $args
+        ./turing --compile "$1" -o "$TMB" || die "Cannot compile $1"
+        for opts in "" "-v" "--max-steps 7"; do
+            expected=$(./turing $opts "$1" "$2" 2>&1)
+            actual=$(./turing $opts "$TMB" "$2" 2>&1)
+            expect_eq "$expected" "$actual" "$opts $1 compiled"
+        done
+    done
+    head -c 64 "$TMB" > "$TMB.bad"
+    actual=$(./turing "$TMB.bad" 1 2>&1) && die "Expecting false return value for a truncated image"
+    expect_eq "Corrupt compiled machine: $TMB.bad" "$actual" "truncated image"
+    # The byte after the blank symbol in the header must be zero.
+    cp "$TMB" "$TMB.bad"
+    printf '\x01' | dd of="$TMB.bad" bs=1 seek=41 conv=notrunc status=none
+    actual=$(./turing "$TMB.bad" 1 2>&1) && die "Expecting false return value for a nonzero header pad"
+    expect_eq "Corrupt compiled machine: $TMB.bad" "$actual" "nonzero header pad"
+    # Table entries must name a rule of their state, and symbol codes must
+    # be below the symbol count.
+    local off
+    for patch in "136 0 \xf0\xff\xff\x7f" "56 98 \xff\x7f"; do
+        set -- $patch
+        off=$(od -An -tu8 -j "$1" -N 8 "$TMB" | tr -d ' ')
+        cp "$TMB" "$TMB.bad"
+        printf "$3" | dd of="$TMB.bad" bs=1 seek=$((off + $2)) conv=notrunc status=none
+        actual=$(./turing "$TMB.bad" 1 2>&1) && die "Expecting false return value for a bad section at $1"
+        expect_eq "Corrupt compiled machine: $TMB.bad" "$actual" "bad section at $1"
+    done
+    ./turing --compile tests/palindrome_detector_2tapes.tm -o "$TMB.bad"
+    cmp -s "$TMB" "$TMB.bad" || die "Expected images of one machine to be identical"
+    rm -f "$TMB" "$TMB.bad"
+    ./turing --compile ../programs/gcd.tm &> /dev/null && die "Expecting false return value for --compile without -o"
+    echo "Compile tests passed."
+}
+
+function test_cycles {
+    echo "Testing cycle detection."
+    actual=$(./turing --detect-cycles tests/loop.tm 000 2>&1)
+    expect_eq 3 $? "--detect-cycles exit status"
+    expect_eq "does not halt: cycle of length 2 entered at step 1" "$actual" "--detect-cycles loop.tm"
+    actual=$(./turing --detect-cycles ../programs/gcd.tm "" 2>&1)
+    expect_eq "does not halt: cycle of length 1 entered at step 1" "$actual" "--detect-cycles gcd.tm"
+    for args in "../programs/gcd.tm 1111110111111111" "../programs/is_sqrt.tm 111111111" \
+                "tests/palindrome_detector_2tapes.tm 1101011"; do
+        expected=$(./turing -v $args 2>&1)
+        actual=$(./turing -v --detect-cycles $args 2>&1)
+        expect_eq "$expected" "$actual" "--detect-cycles $args"
+    done
+    actual=$(printf '1101\n\n' | ./turing --detect-cycles --batch - ../programs/gcd.tm | cut -f4,5 | tr '\n\t' '| ')
+    expect_eq "accept|cycle 1|" "$actual" "--detect-cycles --batch"
+    ./turing --macro --detect-cycles tests/loop.tm 0 &> /dev/null && die "Expecting false return value for --macro --detect-cycles"
+    echo "Cycle tests passed."
+}
+
+function test_trace {
+    echo "Testing trace formats."
+    actual=$(./turing -v --trace-format compact --max-steps 4 tests/loop.tm 00 2>/dev/null | sed -n '3,$p' | tr '\n' '|')
+    expect_eq "0 0 0 0|1 1 1 x|2 2 2 0|3 1 1 _|4 2 2 0|" "$actual" "--trace-format compact"
+    for args in "../programs/gcd.tm 1111110111111111" "tests/palindrome_detector_2tapes.tm 1101011"; do
+        expected=$(./turing -v $args | grep -c '^Step')
+        actual=$(./turing -v --trace-format compact $args | grep -c '^[0-9]')
+        expect_eq "$expected" "$actual" "compact step count for $args"
+        expected=$(./turing -v $args)
+        actual=$(./turing -v --trace-format human $args)
+        expect_eq "$expected" "$actual" "--trace-format human $args"
+    done
+    ./turing --trace-format compact tests/loop.tm 0 &> /dev/null && die "Expecting false return value for --trace-format without -v"
+    ./turing -v --trace-format xml tests/loop.tm 0 &> /dev/null && die "Expecting false return value for an unknown trace format"
+    echo "Trace tests passed."
+}
+
+function test_record {
+    echo "Testing recording and replay."
+    local TM=../programs/gcd.tm REC
+    REC=$(mktemp --suffix=.tmr)
+    expected=$(./turing "$TM" 1111110111111111)
+    actual=$(./turing --record "$REC" "$TM" 1111110111111111)
+    expect_eq "$expected" "$actual" "--record result"
+    for n in 0 1 17; do
+        expected=$(./turing -v --max-steps $n "$TM" 1111110111111111 2>/dev/null | sed -n '/^Step   : '$n'$/,/^---/p')
+        actual=$(./turing --replay "$REC" --at $n "$TM")
+        expect_eq "$expected" "$actual" "--replay --at $n"
+    done
+    expected=$(./turing -v "$TM" 1111110111111111 | grep -B1 '^Result' | head -1)
+    actual=$(./turing --replay "$REC" "$TM" | tail -1)
+    expect_eq "$expected" "$actual" "--replay last step"
+    # Long enough to take several checkpoints
+    ./turing --max-steps 200000 --record "$REC" tests/loop.tm 0 &> /dev/null
+    expect_eq 2 $? "--record exit status at the step limit"
+    for n in 65535 65536 131075 200000; do
+        expected=$(./turing -v --max-steps $n tests/loop.tm 0 2>/dev/null | tail -n 6)
+        actual=$(./turing --replay "$REC" --at $n tests/loop.tm)
+        expect_eq "$expected" "$actual" "--replay --at $n"
+    done
+    ./turing --replay "$REC" --at 200001 tests/loop.tm &> /dev/null && die "Expecting false return value for --at past the end"
+    ./turing --replay "$REC" "$TM" &> /dev/null && die "Expecting false return value for another machine"
+    # The state of the first checkpoint follows the 24-byte header.
+    cp "$REC" "$REC.bad"
+    printf '\xff\xff\xff\x7f' | dd of="$REC.bad" bs=1 seek=24 conv=notrunc status=none
+    actual=$(./turing --replay "$REC.bad" --at 5 tests/loop.tm 2>&1)
+    expect_eq "Corrupt recording: $REC.bad" "$actual" "--replay with a bad state"
+    # Its first tape starts at the cell that follows the head position.
+    cp "$REC" "$REC.bad"
+    printf '\xf0\xff\xff\x7f' | dd of="$REC.bad" bs=1 seek=32 conv=notrunc status=none
+    actual=$(./turing --replay "$REC.bad" --at 5 tests/loop.tm 2>&1)
+    expect_eq "Corrupt recording: $REC.bad" "$actual" "--replay with cells out of reach"
+    rm -f "$REC.bad"
+    ./turing -v --record "$REC" "$TM" 101 &> /dev/null && die "Expecting false return value for --record with -v"
+    rm -f "$REC"
+    echo "Record tests passed."
+}
+
+function test_debug {
+    echo "Testing the debugger."
+    local TM=../programs/gcd.tm input=111111011111111
+    for n in 150 3 201 0 77 76; do
+        expected=$(./turing -v --max-steps $n "$TM" $input 2>/dev/null | sed -n '/^Step   : '$n'$/,/^---/p')
+        actual=$(printf 'goto 150\nback 147\ns 198\ngoto %s\n' $n | ./turing --debug --checkpoint-every 2 "$TM" $input | tail -n 12)
+        expect_eq "$expected" "$actual" "--debug goto $n"
+    done
+    actual=$(printf 'break state lt\nc\nc\ndelete\nc\nback 5\n' | ./turing --debug "$TM" $input | grep -E '^(Step|Break|Halted)' | tr '\n' '|')
+    expect_eq "Step   : 0|Breakpoint: state lt|Step   : 46|Halted|Step   : 201|Halted|Step   : 201|Step   : 196|" "$actual" "--debug breakpoints"
+    actual=$(printf 'break symbol 0 _\nc\nuntil fin\n' | ./turing --debug "$TM" $input | grep -E '^(Step|Break|State)' | tr '\n' '|')
+    expect_eq "Step   : 0|State  : q0|Breakpoint: symbol _ on tape 0|Step   : 20|State  : markA|Step   : 201|State  : fin|" "$actual" "--debug until"
+    ./turing --debug -v "$TM" 1 < /dev/null &> /dev/null && die "Expecting false return value for --debug with -v"
+    echo "Debugger tests passed."
+}
+
+function test_profile {
+    echo "Testing the profiler."
+    expected="Steps   : 10|States  :|             5  50.00%  q1|             4  40.00%  q2|             1  10.00%  q0|"
+    expected+="Rules   :|             5  50.00%  q1 * * r q2|             4  40.00%  q2 * * l q1|             1  10.00%  q0 * x r q1|"
+    expected+="Cells   :|  tape 0: 0 to 2|Step budget exhausted|Steps   : 10|State   : q2|Accepted: no|"
+    actual=$(./turing --profile --max-steps 10 tests/loop.tm 0 2>&1 | tr '\n' '|')
+    expect_eq "$expected" "$actual" "--profile loop.tm"
+    expected=$(./turing ../programs/gcd.tm 111111011111111)
+    actual=$(./turing --profile ../programs/gcd.tm 111111011111111 2>/dev/null)
+    expect_eq "$expected" "$actual" "--profile result"
+    expected="Steps   : $(($(./turing -v ../programs/gcd.tm 111111011111111 | grep -c '^Step') - 1))"
+    actual=$(./turing --profile ../programs/gcd.tm 111111011111111 2>&1 >/dev/null | head -1)
+    expect_eq "$expected" "$actual" "--profile step count"
+    ./turing --profile --macro tests/loop.tm 0 &> /dev/null && die "Expecting false return value for --profile with --macro"
+    echo "Profiler tests passed."
+}
+
+function test_jit {
+    echo "Testing compiled transition functions."
+    local CACHE
+    CACHE=$(mktemp -d)
+    for args in "../programs/gcd.tm 1111110111111111" "../programs/gcd.tm 0" \
+                "../programs/is_sqrt.tm 1111111111111111" \
+                "tests/palindrome_detector_2tapes.tm 1101011" "tests/2.b.tm abcdefghi"; do
+        for budget in "" "--max-steps 7" "--max-steps 300"; do
+            expected=$(./turing $budget $args 2>&1)
+            actual=$(XDG_CACHE_HOME="$CACHE" ./turing --jit $budget $args 2>&1)
+            expect_eq "$expected" "$actual" "--jit $budget $args"
+        done
+    done
+    expect_eq 4 $(ls "$CACHE/turing" | wc -l) "--jit cached objects"
+    local inputs="1101 11110111111 0 2 1 1111111101111111111"
+    expected=$(tr ' ' '\n' <<< "$inputs" | ./turing --max-steps 5000 --batch - ../programs/gcd.tm)
+    actual=$(tr ' ' '\n' <<< "$inputs" | XDG_CACHE_HOME="$CACHE" ./turing --jit -j 2 --max-steps 5000 --batch - ../programs/gcd.tm)
+    expect_eq "$expected" "$actual" "--jit --batch"
+    # A cache others may write to is not used.
+    rm -rf "$CACHE/turing"
+    mkdir -m 777 "$CACHE/turing"
+    actual=$(XDG_CACHE_HOME="$CACHE" ./turing --jit ../programs/gcd.tm 1111110111111111)
+    expect_eq "$(./turing ../programs/gcd.tm 1111110111111111)" "$actual" "--jit with an unsafe cache"
+    expect_eq 0 $(ls "$CACHE/turing" | wc -l) "--jit objects in an unsafe cache"
+    ls -d /tmp/turing-jit-* &> /dev/null && die "Expected the uncached object to be removed"
+    rm -rf "$CACHE"
+    ./turing --jit -v tests/loop.tm 0 &> /dev/null && die "Expecting false return value for --jit with -v"
+    echo "Compiled transition function tests passed."
+}
+
+function test_input_file {
+    echo "Testing input files."
+    local IN
+    IN=$(mktemp)
+    for args in "../programs/gcd.tm 1111110111111111" "tests/palindrome_detector_2tapes.tm 1101011" \
+                "tests/palindrome_detector_2tapes.tm ''"; do
+        set -- $args
+        eval "printf '%s' $2" > "$IN"
+        for opts in "" "--max-steps 7" "--detect-cycles"; do
+            expected=$(eval ./turing $opts $args 2>&1)
+            actual=$(./turing $opts --input-file "$IN" $1 2>&1)
+            expect_eq "$expected" "$actual" "--input-file $opts $args"
+            actual=$(./turing $opts --input-file - $1 < "$IN" 2>&1)
+            expect_eq "$expected" "$actual" "--input-file - $opts $args"
+        done
+    done
+    # A long input, ending with a newline.
+    printf '%0100000d\n' 0 > "$IN"
+    actual=$(./turing --input-file "$IN" tests/palindrome_detector_2tapes.tm)
+    expect_eq "True" "$actual" "--input-file with 100000 symbols"
+    printf '%0100000dx' 0 > "$IN"
+    actual=$(./turing --input-file "$IN" tests/palindrome_detector_2tapes.tm 2>&1) && die "Expecting false return value for an illegal input file"
+    expect_eq "illegal input" "$actual" "--input-file with an illegal symbol"
+    rm -f "$IN"
+    ./turing --input-file "$IN" tests/palindrome_detector_2tapes.tm &> /dev/null && die "Expecting false return value for a missing input file"
+    ./turing --input-file - tests/palindrome_detector_2tapes.tm 0 < /dev/null &> /dev/null && die "Expecting false return value for --input-file with an input"
+    ./turing -v --input-file - tests/palindrome_detector_2tapes.tm < /dev/null &> /dev/null && die "Expecting false return value for --input-file with -v"
+    echo "Input file tests passed."
+}
+
+function test_nondet {
+    echo "Testing nondeterministic runs."
+    for args in "babbab babbxb" "abba abbx" "aabbaabba aabbxabba"; do
+        set -- $args
+        actual=$(./turing --nondeterministic tests/abba.tm $1)
+        expect_eq "$2" "$actual" "--nondeterministic abba.tm $1"
+        actual=$(./turing tests/abba.tm $1)
+        expect_eq "$1" "$actual" "abba.tm $1"
+    done
+    actual=$(./turing --nondeterministic tests/abba.tm abab 2>&1)
+    expect_eq 4 $? "--nondeterministic rejecting exit code"
+    expect_eq "No branch accepts|Depth   : 5|Configs : 9|" "$(tr '\n' '|' <<< "$actual")" "--nondeterministic abba.tm abab"
+    # Revisited configurations end the search.
+    ./turing --nondeterministic tests/loop.tm 00 &> /dev/null
+    expect_eq 4 $? "--nondeterministic loop.tm"
+    for j in 1 3; do
+        actual=$(./turing --nondeterministic -j $j tests/guess.tm 1011001110001)
+        expect_eq "1011001110001" "$actual" "--nondeterministic -j $j guess.tm"
+    done
+    actual=$(./turing --nondeterministic --max-configs 100 tests/guess.tm 1011001110 2>&1 | head -1)
+    expect_eq "Configuration budget exhausted" "$actual" "--max-configs"
+    # The budget stops the search within a level.
+    actual=$(./turing --nondeterministic --max-configs 5000 tests/guess.tm 1011001110001 2>&1 | tail -1)
+    expect_eq "Configs : 5001" "$actual" "--max-configs within a level"
+    ./turing --nondeterministic --max-steps 5 tests/guess.tm 1011001110 &> /dev/null
+    expect_eq 2 $? "--nondeterministic --max-steps"
+    ./turing --max-configs 5 tests/guess.tm 1 &> /dev/null && die "Expecting false return value for --max-configs without --nondeterministic"
+    ./turing --nondeterministic -v tests/guess.tm 1 &> /dev/null && die "Expecting false return value for --nondeterministic with -v"
+    echo "Nondeterministic run tests passed."
+}
+
+function test_stats {
+    echo "Testing run statistics."
+    local TM=../programs/gcd.tm
+    expected=$(./turing $TM 111111011111111)
+    actual=$(./turing --stats $TM 111111011111111 2>/dev/null)
+    expect_eq "$expected" "$actual" "--stats result"
+    actual=$(./turing --stats $TM 111111011111111 2>&1 >/dev/null | grep -E '^(Steps |Tape [0-9])' | tr '\n' '|')
+    expected="Steps       : 201|Tape 0      : head range -1 to 15, 17 cells, 134 moves|"
+    expected+="Tape 1      : head range -7 to 0, 8 cells, 58 moves|Tape 2      : head range 0 to 9, 10 cells, 54 moves|"
+    expect_eq "$expected" "$actual" "--stats gcd.tm"
+    actual=$(./turing --stats=json --max-steps 10 tests/loop.tm 0 2>&1 | head -1 | grep -o '"steps": [0-9]*\|"tapes": [^]]*]')
+    expect_eq '"steps": 10|"tapes": [{"low": 0, "high": 2, "head_cells": 3, "travel": 10}]|' "$(tr '\n' '|' <<< "$actual")" "--stats=json loop.tm"
+    # Machines of more than four tapes run on the generic engine.
+    local WIDE
+    WIDE=$(mktemp)
+    printf '#Q = {q0,halt}\n#S = {0}\n#G = {0,_}\n#q0 = q0\n#B = _\n#F = {halt}\n#N = 5\n%s\n%s\n' \
+        'q0 0__*_ _0000 rrl*r q0' 'q0 ___*_ _____ ***** halt' > "$WIDE"
+    actual=$(./turing --stats=json "$WIDE" 000 2>&1 | grep -o '"steps": [0-9]*\|"tapes": [^]]*]')
+    expected='"steps": 4|"tapes": [{"low": 0, "high": 3, "head_cells": 4, "travel": 3}, {"low": 0, "high": 3, "head_cells": 4, "travel": 3}, '
+    expected+='{"low": -3, "high": 0, "head_cells": 4, "travel": 3}, {"low": 0, "high": 0, "head_cells": 1, "travel": 0}, {"low": 0, "high": 3, "head_cells": 4, "travel": 3}]|'
+    expect_eq "$expected" "$(tr '\n' '|' <<< "$actual")" "--stats=json on five tapes"
+    rm -f "$WIDE"
+    ./turing --stats=xml $TM 1 &> /dev/null && die "Expecting false return value for --stats=xml"
+    ./turing --stats --macro $TM 1 &> /dev/null && die "Expecting false return value for --stats with --macro"
+    echo "Run statistics tests passed."
+}
+
+function test_checkpoint {
+    echo "Testing checkpoints."
+    local TM=../programs/gcd.tm CKP
+    CKP=$(mktemp)
+    expected=$(./turing $TM 1111110111111111)
+    for every in 1 7 50 1000; do
+        ./turing --checkpoint "$CKP" --checkpoint-every $every --max-steps 120 $TM 1111110111111111 &> /dev/null
+        expect_eq 2 $? "--checkpoint-every $every exit code"
+        actual=$(./turing --resume "$CKP" $TM)
+        expect_eq "$expected" "$actual" "--resume after --checkpoint-every $every"
+    done
+    # Step budgets count the steps taken before the checkpoint.
+    ./turing --checkpoint "$CKP" --checkpoint-every 100 --max-steps 150 $TM 1111110111111111 &> /dev/null
+    expected=$(./turing --max-steps 170 $TM 1111110111111111 2>&1)
+    actual=$(./turing --resume "$CKP" --max-steps 170 $TM 2>&1)
+    expect_eq "$expected" "$actual" "--resume --max-steps"
+    actual=$(./turing --jit --resume "$CKP" $TM 2>&1)
+    expect_eq "$(./turing $TM 1111110111111111)" "$actual" "--resume --jit"
+    ./turing --checkpoint "$CKP" tests/loop.tm 0 &
+    sleep 0.2
+    kill -TERM $!
+    wait $!
+    expect_eq 143 $? "--checkpoint on SIGTERM"
+    steps=$(./turing --resume "$CKP" --max-steps 0 tests/loop.tm 2>&1 | grep '^Steps' | tr -dc 0-9)
+    [ "$steps" -gt 0 ] || die "Expected a checkpoint after some steps, got $steps"
+    actual=$(./turing --resume "$CKP" --max-steps $((steps + 3)) tests/loop.tm 2>&1 | grep '^Steps')
+    expect_eq "Steps   : $((steps + 3))" "$actual" "--resume after SIGTERM"
+    actual=$(./turing --resume "$CKP" $TM 2>&1)
+    expect_eq "Checkpoint was made with another machine: $CKP" "$actual" "--resume with another machine"
+    actual=$(./turing --resume $TM $TM 2>&1)
+    expect_eq "Not a checkpoint: $TM" "$actual" "--resume with a machine file"
+    # The head of tape 0 follows the 32-byte header and the state.
+    cp "$CKP" "$CKP.bad"
+    printf '\xf0\xff\xff\x7f' | dd of="$CKP.bad" bs=1 seek=36 conv=notrunc status=none
+    actual=$(./turing --resume "$CKP.bad" tests/loop.tm 2>&1)
+    expect_eq "Corrupt checkpoint: $CKP.bad" "$actual" "--resume with a head out of reach"
+    [ -e "$CKP.tmp" ] && die "Expected no temporary checkpoint to be left"
+    rm -f "$CKP.bad"
+    rm -f "$CKP"
+    ./turing --checkpoint-every 5 $TM 1 &> /dev/null && die "Expecting false return value for --checkpoint-every alone"
+    ./turing --checkpoint "$CKP" -v $TM 1 &> /dev/null && die "Expecting false return value for --checkpoint with -v"
+    echo "Checkpoint tests passed."
+}
+
+function test_contents {
+    echo "Testing results."
+    for args in "0110100 11010" "01 ''" "0 ''" "'' ''" "$(printf '1%.0s' $(seq 5000)) $(printf '1%.0s' $(seq 4998))"; do
+        eval set -- $args
+        actual=$(./turing tests/trim.tm "$1")
+        expect_eq "$2" "$actual" "trim.tm $1"
+        actual=$(./turing -v tests/trim.tm "$1" | grep '^Result')
+        expect_eq "Result: $2" "$actual" "trim.tm -v $1"
+    done
+    echo "Result tests passed."
+}
+
 test_errors
+test_limits
+test_macro
+test_batch
+test_compile
+test_cycles
+test_trace
+test_record
+test_debug
+test_profile
+test_jit
+test_input_file
+test_nondet
+test_stats
+test_checkpoint
+test_contents
 test_gcd
 test_palindrome
 echo "All tests passed."
@@ -0,0 +1,16 @@
+; Accepts inputs containing abba, guessing where it starts. Run
+; deterministically, it never guesses and always rejects.
+#Q = {q0,q1,q2,q3,acc}
+#S = {a,b}
+#G = {a,b,x,_}
+#q0 = q0
+#B = _
+#F = {acc}
+#N = 1
+
+q0 a a r q0
+q0 b b r q0
+q0 a a r q1
+q1 b b r q2
+q2 b b r q3
+q3 a x * acc
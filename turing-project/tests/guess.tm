@@ -0,0 +1,18 @@
+; Guesses a binary string on tape 1 as long as the input, then accepts if
+; it equals the input: one branch out of 2^n accepts.
+#Q = {guess,cmp,acc}
+#S = {0,1}
+#G = {0,1,_}
+#q0 = guess
+#B = _
+#F = {acc}
+#N = 2
+
+guess 0_ 00 rr guess
+guess 0_ 01 rr guess
+guess 1_ 10 rr guess
+guess 1_ 11 rr guess
+guess __ __ ll cmp
+cmp 00 ** ll cmp
+cmp 11 ** ll cmp
+cmp __ __ ** acc
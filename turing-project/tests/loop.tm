@@ -0,0 +1,12 @@
+; Marks the first cell, then walks back and forth forever.
+#Q = {q0,q1,q2,halt}
+#S = {0}
+#G = {0,x,_}
+#q0 = q0
+#B = _
+#F = {halt}
+#N = 1
+
+q0 * x r q1
+q1 * * r q2
+q2 * * l q1
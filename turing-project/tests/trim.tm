@@ -0,0 +1,15 @@
+; Erases the first and the last symbol of the input.
+#Q = {q0,go,back,done}
+#S = {0,1}
+#G = {0,1,_}
+#q0 = q0
+#B = _
+#F = {done}
+#N = 1
+
+q0 * _ r go
+go 0 0 r go
+go 1 1 r go
+go _ _ l back
+back 0 _ l done
+back 1 _ l done
@@ -1,6 +1,28 @@
 #include "tm.h"
+#include "match.h"
 #include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+string Alphabet::symbols() const {
+    string res;
+    for (int c = 0; c < 256; ++c)
+        if (_bits.test(c))
+            res.push_back((char)c);
+    return res;
+}
+
+optional<char> Alphabet::firstOutside(const Alphabet &other) const {
+    const auto rest = _bits & ~other._bits;
+    for (int c = 0; c < 256; ++c)
+        if (rest.test(c))
+            return (char)c;
+    return std::nullopt;
+}
 
 TmBuilder::TmBuilder(uint32_t tapeCount) : _tapeCount(tapeCount) {}
 
@@ -10,14 +32,23 @@ TmBuilder TmBuilder::withTapes(uint32_t tapeCount) {
     return TmBuilder(tapeCount);
 }
 
-void TmBuilder::_mustHaveState(const StateName &name) const {
-    auto it = _states.find(name);
-    if (it == _states.end())
-        throw TmBuilderError{string("Undeclared state: ") + name};
+// Symbols of a rule as stored by the builder: the character code, -1 for a
+// wildcard, or BLANK for the blank symbol, which may be set after the rule.
+static const int16_t BLANK = -2;
+
+StateIdx TmBuilder::_mustHaveState(string_view name) const {
+    auto it = _stateId.find(name);
+    if (it == _stateId.end())
+        throw TmBuilderError{string("Undeclared state: ") + string(name)};
+    return it->second;
 }
 
 TmBuilder &TmBuilder::addState(StateName name) {
-    _states.insert(name);
+    if (_stateId.count(name))
+        return *this;
+    _stateNames.push_back(std::move(name));
+    _stateId.emplace(_stateNames.back(), _stateNames.size() - 1);
+    _final.push_back(0);
     return *this;
 }
 
@@ -32,24 +63,34 @@ TmBuilder &TmBuilder::addTapeSymbol(char c) {
 }
 
 TmBuilder &TmBuilder::makeFinal(StateName name) {
-    _mustHaveState(name);
-    _finalStates.insert(name);
+    _final[_mustHaveState(name)] = 1;
     return *this;
 }
 
 TmBuilder &TmBuilder::makeInitial(StateName name) {
-    _mustHaveState(name);
-    _initialState = name;
+    _initialState = _mustHaveState(name);
     return *this;
 }
 
-TmBuilder &TmBuilder::addTransition(StateName srcState,
-                                    std::vector<TapeChar> &get,
-                                    StateName dstState,
-                                    std::vector<TapeChar> &put,
+int16_t TmBuilder::_code(const TapeChar &c, const char *what) const {
+    if (c.type == c.Wildcard)
+        return -1;
+    if (c.type == c.Blank)
+        return BLANK;
+    if (_tapeAlphabet.count(c.c) == 0) {
+        throw TmBuilderError{string("Character ") + c.c + " to " + what +
+                             " is outside the alphabet"};
+    }
+    return (unsigned char)c.c;
+}
+
+TmBuilder &TmBuilder::addTransition(string_view srcState,
+                                    const vector<TapeChar> &get,
+                                    string_view dstState,
+                                    const vector<TapeChar> &put,
                                     const vector<Dir> &dirs) {
-    _mustHaveState(srcState);
-    _mustHaveState(dstState);
+    const auto src = _mustHaveState(srcState);
+    const auto dst = _mustHaveState(dstState);
     if (get.size() != _tapeCount || put.size() != _tapeCount) {
         throw TmBuilderError{
             string("Number of get/put symbols must equal that of tapes")};
@@ -57,19 +98,21 @@ TmBuilder &TmBuilder::addTransition(StateName srcState,
         throw TmBuilderError{
             string("Number of directions must equal that of tapes")};
     }
-    for (auto c : get) {
-        if (c.type == c.Char && this->_tapeAlphabet.count(c.c) == 0) {
-            throw TmBuilderError{string("Character ") + c.c +
-                                 " to read is outside the alphabet"};
-        }
-    }
-    for (auto c : put) {
-        if (c.type == c.Char && this->_tapeAlphabet.count(c.c) == 0) {
-            throw TmBuilderError{string("Character ") + c.c +
-                                 " to write is outside the alphabet"};
-        }
+    const auto size = _get.size();
+    try {
+        for (const auto &c : get)
+            _get.push_back(_code(c, "read"));
+        for (const auto &c : put)
+            _put.push_back(_code(c, "write"));
+    } catch (const TmBuilderError &) {
+        // A rejected rule leaves the builder as it was.
+        _get.resize(size);
+        _put.resize(size);
+        throw;
     }
-    _rules.emplace_back(srcState, dstState, get, put, dirs);
+    _src.push_back(src);
+    _dst.push_back(dst);
+    _dirs.insert(_dirs.end(), dirs.begin(), dirs.end());
     return *this;
 }
 
@@ -78,8 +121,123 @@ TmBuilder &TmBuilder::setBlankChar(char c) {
     return *this;
 }
 
+// Upper bound on the number of entries in the flat transition table.
+static const size_t MAX_TABLE_SIZE = 1 << 24;
+
+// Layout of a compiled image (.tmb file): a TmbHeader followed by the
+// sections, each aligned to 8 bytes. Integers are stored in the byte order
+// and representation of the machine that wrote the file, recorded in
+// byteOrder so that foreign files are rejected rather than misread.
+static const char TMB_MAGIC[4] = {'T', 'M', 'B', '\x1a'};
+static const uint32_t TMB_VERSION = 1;
+static const uint32_t TMB_BYTE_ORDER = 0x01020304;
+
+enum Section {
+    S_IN_ALPHABET,
+    S_SYM_CODE,
+    S_FINAL,
+    S_NAME_START,
+    S_NAMES,
+    S_RULE_START,
+    S_RULE_LIST,
+    S_DST,
+    S_GET,
+    S_PUT,
+    S_DIRS,
+    S_TABLE,
+    SECTION_COUNT
+};
+
+struct TmbHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t tapeCount, stateCount, ruleCount, initialState, symCount;
+    uint64_t stride;
+    char blankChar;
+    // Zero. Spelled out so that no byte of the header, which is part of
+    // the image and so of Tm::hash(), is left to the compiler.
+    char pad[7];
+    uint64_t offset[SECTION_COUNT], length[SECTION_COUNT];
+};
+static_assert(sizeof(TmbHeader) == 48 + 16 * SECTION_COUNT,
+              "TmbHeader must have no implicit padding");
+
+// Assigns dense codes to the tape symbols and expands the rules of each
+// state into a table indexed by the read tuple, so that transition() does
+// not need to look at the rules at all. Returns an empty table, leaving
+// stride unspecified, when it would exceed MAX_TABLE_SIZE.
+static vector<int32_t> compileTable(uint32_t tapeCount, uint32_t stateCount,
+                                    uint32_t symCount, const int16_t *symCode,
+                                    const vector<uint32_t> &ruleStart,
+                                    const vector<uint32_t> &ruleList,
+                                    const int16_t *gets, size_t &stride) {
+    vector<int32_t> table;
+    stride = 1;
+    for (uint32_t i = 0; i < tapeCount; ++i) {
+        if (stride > MAX_TABLE_SIZE / symCount)
+            return table;
+        stride *= symCount;
+    }
+    if (stride * stateCount > MAX_TABLE_SIZE)
+        return table;
+    table.assign(stride * stateCount, -1);
+    vector<size_t> cur(tapeCount);
+    for (StateIdx s = 0; s < stateCount; ++s) {
+        size_t filled = 0;
+        auto *row = &table[s * stride];
+        // Earlier rules take precedence, so a later rule only fills the
+        // entries that are still free.
+        for (auto k = ruleStart[s]; k < ruleStart[s + 1]; ++k) {
+            const auto r = ruleList[k];
+            const auto *get = &gets[r * tapeCount];
+            bool valid = true;
+            for (uint32_t i = 0; i < tapeCount; ++i) {
+                if (get[i] >= 0 && symCode[get[i]] < 0)
+                    valid = false;
+                cur[i] = get[i] < 0 ? 0 : symCode[get[i]];
+            }
+            if (!valid)
+                continue;
+            // Enumerate every tuple matched by r, odometer-style over the
+            // wildcard positions.
+            while (1) {
+                size_t key = 0;
+                for (uint32_t i = 0; i < tapeCount; ++i)
+                    key = key * symCount + cur[i];
+                if (row[key] < 0) {
+                    row[key] = r;
+                    ++filled;
+                }
+                bool carry = true;
+                for (uint32_t i = tapeCount; carry && i-- > 0;) {
+                    if (get[i] >= 0)
+                        continue;
+                    if (++cur[i] < symCount)
+                        carry = false;
+                    else
+                        cur[i] = 0;
+                }
+                if (carry)
+                    break;
+            }
+            if (filled == stride)
+                break;
+        }
+    }
+    return table;
+}
+
+template <class T>
+static void addSection(string &image, TmbHeader &hdr, Section sec,
+                       const T *data, size_t count) {
+    image.resize((image.size() + 7) & ~(size_t)7);
+    hdr.offset[sec] = image.size();
+    hdr.length[sec] = count * sizeof(T);
+    image.append((const char *)data, count * sizeof(T));
+}
+
 Tm TmBuilder::build() const {
-    Tm res;
     // Check if the blank symbol is declared
     if (!_blankChar.has_value()) {
         throw TmBuilderError{"Blank symbol not specified"};
@@ -90,206 +248,698 @@ Tm TmBuilder::build() const {
                              " is not in the tape alphabet"};
     }
     // Check if the tape alphabet is a superset of the input alphabet
-    for (auto c : _inAlphabet) {
-        if (_tapeAlphabet.count(c) == 0) {
-            throw TmBuilderError{string("The input symbol ") + c +
-                                 " is not present in the tape alphabet"};
-        }
+    if (const auto c = _inAlphabet.firstOutside(_tapeAlphabet)) {
+        throw TmBuilderError{string("The input symbol ") + c.value() +
+                             " is not present in the tape alphabet"};
+    }
+    TmbHeader hdr = {};
+    std::copy(TMB_MAGIC, TMB_MAGIC + 4, hdr.magic);
+    hdr.version = TMB_VERSION;
+    hdr.byteOrder = TMB_BYTE_ORDER;
+    hdr.tapeCount = _tapeCount;
+    hdr.stateCount = _stateNames.size();
+    hdr.ruleCount = _src.size();
+    hdr.blankChar = _blankChar.value();
+    const int16_t blank = (unsigned char)hdr.blankChar;
+
+    vector<uint32_t> nameStart = {0};
+    string names;
+    for (const auto &s : _stateNames) {
+        names += s;
+        nameStart.push_back(names.size());
+    }
+    hdr.initialState = _initialState.value();
+    std::array<uint8_t, 256> inAlphabet = {};
+    for (int c = 0; c < 256; ++c)
+        inAlphabet[c] = _inAlphabet.count((char)c);
+    std::array<int16_t, 256> symCode;
+    symCode.fill(-1);
+    for (int c = 0; c < 256; ++c) {
+        if (_tapeAlphabet.count((char)c))
+            symCode[c] = hdr.symCount++;
     }
-    res._tapeCount = _tapeCount;
-    for (auto s : _states) {
-        auto idx = res._stateName.size();
-        res._stateId[s] = idx;
-        res._states.insert(idx);
-        res._stateName.push_back(s);
-    }
-    for (auto s : _finalStates) {
-        res._finalStates.insert(res._stateId.at(s));
-    }
-    res._initialState = res._stateId.at(_initialState.value());
-    res._inAlphabet = _inAlphabet;
-    res._tapeAlphabet = _tapeAlphabet;
-    res._blankChar = _blankChar.value();
-    // transitions
-    res._rules.reserve(_states.size());
-    for (size_t _ = 0; _ < _states.size(); ++_) {
-        res._rules.emplace_back();
-    }
-    for (auto r : _rules) {
-        auto src = res._stateId.at(r.src), dst = res._stateId.at(r.dst);
-        res._rules.at(src).emplace_back(src, dst, r.get, r.put, r.dirs);
+    // Groups the rules by source state, keeping declaration order.
+    vector<uint32_t> ruleStart(hdr.stateCount + 1), ruleList(hdr.ruleCount);
+    for (auto s : _src)
+        ++ruleStart[s + 1];
+    for (StateIdx s = 0; s < hdr.stateCount; ++s)
+        ruleStart[s + 1] += ruleStart[s];
+    {
+        auto next = ruleStart;
+        for (uint32_t r = 0; r < hdr.ruleCount; ++r)
+            ruleList[next[_src[r]]++] = r;
     }
+
+    auto image = std::make_shared<string>(sizeof(TmbHeader), '\0');
+    addSection(*image, hdr, S_IN_ALPHABET, inAlphabet.data(), 256);
+    addSection(*image, hdr, S_SYM_CODE, symCode.data(), 256);
+    addSection(*image, hdr, S_FINAL, _final.data(), _final.size());
+    addSection(*image, hdr, S_NAME_START, nameStart.data(), nameStart.size());
+    addSection(*image, hdr, S_NAMES, names.data(), names.size());
+    addSection(*image, hdr, S_RULE_START, ruleStart.data(), ruleStart.size());
+    addSection(*image, hdr, S_RULE_LIST, ruleList.data(), ruleList.size());
+    addSection(*image, hdr, S_DST, _dst.data(), _dst.size());
+    addSection(*image, hdr, S_GET, _get.data(), _get.size());
+    addSection(*image, hdr, S_PUT, _put.data(), _put.size());
+    addSection(*image, hdr, S_DIRS, _dirs.data(), _dirs.size());
+    // The blank symbol is only known now; it is filled in within the image
+    // rather than in a copy of the rules.
+    auto *get = (int16_t *)&(*image)[hdr.offset[S_GET]];
+    auto *put = (int16_t *)&(*image)[hdr.offset[S_PUT]];
+    std::replace(get, get + _get.size(), BLANK, blank);
+    std::replace(put, put + _put.size(), BLANK, blank);
+    size_t stride;
+    const auto table =
+        compileTable(_tapeCount, hdr.stateCount, hdr.symCount, symCode.data(),
+                     ruleStart, ruleList, get, stride);
+    hdr.stride = table.empty() ? 0 : stride;
+    addSection(*image, hdr, S_TABLE, table.data(), table.size());
+    std::copy((const char *)&hdr, (const char *)(&hdr + 1), image->begin());
+    Tm res;
+    res._attach(image, *image);
     return res;
 }
 
 Tm::Tm() {}
 
+// Points the sections at an image that has already been checked.
+void Tm::_attach(std::shared_ptr<const void> owner, string_view image) {
+    const auto &hdr = *(const TmbHeader *)image.data();
+    const auto at = [&](Section sec) { return image.data() + hdr.offset[sec]; };
+    _owner = std::move(owner);
+    _image = image;
+    _tapeCount = hdr.tapeCount;
+    _stateCount = hdr.stateCount;
+    _ruleCount = hdr.ruleCount;
+    _initialState = hdr.initialState;
+    _blankChar = hdr.blankChar;
+    _symCount = hdr.symCount;
+    _stride = hdr.stride;
+    _inAlphabet = (const uint8_t *)at(S_IN_ALPHABET);
+    _symCode = (const int16_t *)at(S_SYM_CODE);
+    _final = (const uint8_t *)at(S_FINAL);
+    _nameStart = (const uint32_t *)at(S_NAME_START);
+    _names = at(S_NAMES);
+    _ruleStart = (const uint32_t *)at(S_RULE_START);
+    _ruleList = (const uint32_t *)at(S_RULE_LIST);
+    _dst = (const StateIdx *)at(S_DST);
+    _get = (const int16_t *)at(S_GET);
+    _put = (const int16_t *)at(S_PUT);
+    _dirs = (const Dir *)at(S_DIRS);
+    _table = hdr.length[S_TABLE] ? (const int32_t *)at(S_TABLE) : nullptr;
+    _matcher = _table ? nullptr : std::make_shared<RuleMatcher>(*this);
+    _inRangeCount = 0;
+    for (int c = 0; c < 256; ++c) {
+        if (!_inAlphabet[c] || (c > 0 && _inAlphabet[c - 1]))
+            continue;
+        if (_inRangeCount == IN_RANGES) {
+            _inRangeCount = 0;
+            break;
+        }
+        auto hi = c;
+        while (hi < 255 && _inAlphabet[hi + 1])
+            ++hi;
+        _inLow[_inRangeCount] = c;
+        _inSpan[_inRangeCount++] = hi - c;
+    }
+}
+
+bool Tm::isImage(string_view data) {
+    return data.size() >= sizeof(TMB_MAGIC) &&
+           data.substr(0, sizeof(TMB_MAGIC)) ==
+               string_view(TMB_MAGIC, sizeof(TMB_MAGIC));
+}
+
+// Loads an image written from image(), which owner keeps alive. The header,
+// the rules, the symbol codes and the transition table are checked, so that
+// a damaged file cannot make the machine read outside the image.
+Tm Tm::fromImage(std::shared_ptr<const void> owner, string_view image) {
+    if (!isImage(image))
+        throw TmError{"Not a compiled machine"};
+    if ((uintptr_t)image.data() % alignof(uint64_t) != 0) {
+        auto copy = std::make_shared<string>(image);
+        return fromImage(copy, *copy);
+    }
+    if (image.size() < sizeof(TmbHeader))
+        throw TmError{"Corrupt compiled machine"};
+    const auto &hdr = *(const TmbHeader *)image.data();
+    if (hdr.version != TMB_VERSION || hdr.byteOrder != TMB_BYTE_ORDER)
+        throw TmError{"Unsupported compiled machine format"};
+    const auto corrupt = TmError{"Corrupt compiled machine"};
+    const uint64_t states = hdr.stateCount, rules = hdr.ruleCount,
+                   cells = rules * hdr.tapeCount;
+    if (hdr.tapeCount == 0 || hdr.initialState >= states ||
+        hdr.symCount > 256 ||
+        std::any_of(hdr.pad, hdr.pad + sizeof hdr.pad,
+                    [](char c) { return c != 0; }))
+        throw corrupt;
+    uint64_t tableSize = 0;
+    if (hdr.stride) {
+        tableSize = 1;
+        for (uint32_t i = 0; i < hdr.tapeCount && tableSize <= hdr.stride; ++i)
+            tableSize *= hdr.symCount;
+        if (tableSize != hdr.stride || tableSize * states > MAX_TABLE_SIZE)
+            throw corrupt;
+        tableSize *= states;
+    }
+    const uint64_t length[SECTION_COUNT] = {
+        256,
+        256 * sizeof(int16_t),
+        states,
+        (states + 1) * sizeof(uint32_t),
+        hdr.length[S_NAMES],
+        (states + 1) * sizeof(uint32_t),
+        rules * sizeof(uint32_t),
+        rules * sizeof(StateIdx),
+        cells * sizeof(int16_t),
+        cells * sizeof(int16_t),
+        cells * sizeof(Dir),
+        tableSize * sizeof(int32_t)};
+    for (int sec = 0; sec < SECTION_COUNT; ++sec) {
+        if (hdr.length[sec] != length[sec] || hdr.offset[sec] % 8 != 0 ||
+            hdr.offset[sec] < sizeof(TmbHeader) ||
+            hdr.offset[sec] > image.size() ||
+            length[sec] > image.size() - hdr.offset[sec])
+            throw corrupt;
+    }
+    Tm res;
+    res._attach(owner, image);
+    for (uint64_t s = 0; s < states; ++s) {
+        if (res._nameStart[s] > res._nameStart[s + 1] ||
+            res._ruleStart[s] > res._ruleStart[s + 1])
+            throw corrupt;
+    }
+    if (res._nameStart[0] != 0 || res._nameStart[states] != length[S_NAMES] ||
+        res._ruleStart[0] != 0 || res._ruleStart[states] != rules)
+        throw corrupt;
+    for (uint64_t r = 0; r < rules; ++r) {
+        if (res._ruleList[r] >= rules || res._dst[r] >= states)
+            throw corrupt;
+    }
+    // Every rule is listed under exactly one state, its source.
+    vector<StateIdx> src(rules, (StateIdx)states);
+    for (uint64_t s = 0; s < states; ++s) {
+        for (auto k = res._ruleStart[s]; k < res._ruleStart[s + 1]; ++k) {
+            auto &owner = src[res._ruleList[k]];
+            if (owner != states)
+                throw corrupt;
+            owner = s;
+        }
+    }
+    for (int c = 0; c < 256; ++c) {
+        if (res._symCode[c] < -1 || res._symCode[c] >= (int)hdr.symCount)
+            throw corrupt;
+    }
+    for (uint64_t i = 0; i < tableSize; ++i) {
+        const auto r = res._table[i];
+        if (r < -1 || (r >= 0 && ((uint64_t)r >= rules ||
+                                  src[r] != i / hdr.stride)))
+            throw corrupt;
+    }
+    for (uint64_t i = 0; i < cells; ++i) {
+        if (res._get[i] < -1 || res._get[i] > 255 || res._put[i] < -1 ||
+            res._put[i] > 255 || (unsigned)res._dirs[i] > N)
+            throw corrupt;
+    }
+    return res;
+}
+
+string_view Tm::image() const { return _image; }
+
+// FNV-1a over the image.
+uint64_t Tm::hash() const {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (auto c : _image)
+        h = (h ^ (unsigned char)c) * 0x100000001b3ull;
+    return h;
+}
+
 char Tm::blankChar() const { return _blankChar; }
 
-string Tm::stateName(StateIdx id) const { return this->_stateName.at(id); }
+uint32_t Tm::stateCount() const { return _stateCount; }
 
-bool Tm::validate(char c) const { return _inAlphabet.count(c) != 0; }
+string Tm::stateName(StateIdx id) const {
+    if (id >= _stateCount)
+        throw std::out_of_range("Tm::stateName");
+    return string(_names + _nameStart[id], _nameStart[id + 1] - _nameStart[id]);
+}
 
-bool Tm::validate(string input) const {
-    for (auto c : input)
-        if (_inAlphabet.count(c) == 0)
-            return false;
-    return true;
+StateIdx Tm::initialState() const { return _initialState; }
+
+const vector<StateIdx> Tm::finalStates() const {
+    vector<StateIdx> res;
+    for (StateIdx s = 0; s < _stateCount; ++s)
+        if (_final[s])
+            res.push_back(s);
+    return res;
 }
 
-Id Tm::initialId(string input) const {
-    for (auto c : input) {
-        if (_inAlphabet.count(c) == 0)
-            throw TmError{string("Not a valid input symbol: ") + c};
+bool Tm::isFinal(StateIdx s) const { return s < _stateCount && _final[s]; }
+
+uint32_t Tm::tapeCount() const { return _tapeCount; }
+
+uint32_t Tm::ruleCount() const { return _ruleCount; }
+
+StateIdx Tm::ruleDst(uint32_t r) const { return _dst[r]; }
+
+const int16_t *Tm::ruleGet(uint32_t r) const {
+    return &_get[r * _tapeCount];
+}
+
+const int16_t *Tm::rulePut(uint32_t r) const {
+    return &_put[r * _tapeCount];
+}
+
+const Dir *Tm::ruleDirs(uint32_t r) const { return &_dirs[r * _tapeCount]; }
+
+pair<const uint32_t *, const uint32_t *> Tm::stateRules(StateIdx s) const {
+    return {_ruleList + _ruleStart[s], _ruleList + _ruleStart[s + 1]};
+}
+
+bool Tm::validate(char c) const { return _inAlphabet[(unsigned char)c]; }
+
+bool Tm::validate(const string &input) const {
+    return firstInvalid(input) == string::npos;
+}
+
+size_t Tm::firstInvalid(string_view input) const {
+    size_t k = 0;
+#ifdef __SSE2__
+    // Skips whole blocks that are in the alphabet, leaving the one holding
+    // the first invalid character, if any, to the loop below.
+    if (_inRangeCount) {
+        __m128i low[IN_RANGES], span[IN_RANGES];
+        for (uint32_t r = 0; r < _inRangeCount; ++r) {
+            low[r] = _mm_set1_epi8((char)_inLow[r]);
+            span[r] = _mm_set1_epi8((char)_inSpan[r]);
+        }
+        const auto valid = [&](size_t at) {
+            const auto c =
+                _mm_loadu_si128((const __m128i *)(input.data() + at));
+            auto res = _mm_setzero_si128();
+            for (uint32_t r = 0; r < _inRangeCount; ++r) {
+                const auto d = _mm_sub_epi8(c, low[r]);
+                res = _mm_or_si128(
+                    res, _mm_cmpeq_epi8(_mm_min_epu8(d, span[r]), d));
+            }
+            return res;
+        };
+        for (; k + 64 <= input.size(); k += 64) {
+            const auto res = _mm_and_si128(
+                _mm_and_si128(valid(k), valid(k + 16)),
+                _mm_and_si128(valid(k + 32), valid(k + 48)));
+            if (_mm_movemask_epi8(res) != 0xffff)
+                break;
+        }
+        for (; k + 16 <= input.size(); k += 16)
+            if (_mm_movemask_epi8(valid(k)) != 0xffff)
+                break;
     }
+#endif
+    for (; k < input.size(); ++k)
+        if (!_inAlphabet[(unsigned char)input[k]])
+            return k;
+    return string::npos;
+}
+
+Id Tm::initialId(string input) const {
+    if (const auto k = firstInvalid(input); k != string::npos)
+        throw TmError{string("Not a valid input symbol: ") + input[k]};
     return Id{_initialState, _tapeCount, _blankChar, input};
 }
 
+Tape::Tape(char blankChar, string input)
+    : _buf(input.begin(), input.end()), _origin(0), _blankChar(blankChar),
+      _lo(0), _hi(_buf.size()) {}
+
+Tape::Tape(char blankChar, vector<char> input)
+    : _buf(std::move(input)), _origin(0), _blankChar(blankChar), _lo(0),
+      _hi(_buf.size()) {}
+
+Tape::Tape(char blankChar, int32_t first, vector<char> cells)
+    : _buf(std::move(cells)), _origin(-first), _blankChar(blankChar),
+      _lo(first), _hi(first + (int32_t)_buf.size()) {}
+
+// Makes room for pos, at least doubling the buffer.
+void Tape::_grow(int32_t pos) {
+    const int64_t size = _buf.size(), k = (int64_t)pos + _origin;
+    if (k < 0) {
+        const int64_t extra = std::max(-k, std::max<int64_t>(size, 16));
+        _buf.insert(_buf.begin(), extra, _blankChar);
+        _origin += extra;
+    } else if (k >= size) {
+        _buf.resize(std::max(k + 1, std::max<int64_t>(2 * size, 16)),
+                    _blankChar);
+    }
+}
+
+// Returns the range [left, right) of cells held in the buffer. Every
+// non-blank cell lies within it.
+pair<int32_t, int32_t> Tape::extent() const {
+    return {-_origin, (int32_t)_buf.size() - _origin};
+}
+
+// Runs of blanks are skipped a word at a time.
+pair<int32_t, int32_t> Tape::nonBlank() const {
+    uint64_t blanks;
+    std::memset(&blanks, _blankChar, sizeof blanks);
+    const auto ext = extent();
+    const char *lo = _buf.data() + _origin + std::max(_lo, ext.first);
+    const char *hi = _buf.data() + _origin + std::min(_hi, ext.second);
+    const auto isBlank = [&blanks](const char *p) {
+        uint64_t w;
+        std::memcpy(&w, p, sizeof w);
+        return w == blanks;
+    };
+    while (hi - lo >= 8 && isBlank(lo))
+        lo += 8;
+    while (lo < hi && *lo == _blankChar)
+        ++lo;
+    while (hi - lo >= 8 && isBlank(hi - 8))
+        hi -= 8;
+    while (lo < hi && hi[-1] == _blankChar)
+        --hi;
+    _lo = lo - _buf.data() - _origin;
+    _hi = hi - _buf.data() - _origin;
+    return {_lo, _hi};
+}
+
+string Tape::slice(int32_t lo, int32_t hi) const {
+    string res;
+    if (lo >= hi)
+        return res;
+    res.reserve(hi - lo);
+    const auto ext = extent();
+    const auto from = std::max(lo, ext.first), to = std::min(hi, ext.second);
+    if (from >= to)
+        return string(hi - lo, _blankChar);
+    res.append(from - lo, _blankChar);
+    res.append(span(from, to));
+    res.append(hi - to, _blankChar);
+    return res;
+}
+
 Id::Id(StateIdx state, uint32_t tapeCount, char blankChar, string input)
     : _tapeCount(tapeCount), _state(state),
       _position(vector<int32_t>(tapeCount, 0)),
-      _tapeL({tapeCount, deque<char>()}), _tapeGE({tapeCount, deque<char>()}),
-      _blankChar(blankChar) {
-    auto &first = _tapeGE.at(0);
-    first.insert(first.begin(), input.begin(), input.end());
+      _tapes(tapeCount, Tape(blankChar, "")), _blankChar(blankChar) {
+    _tapes.at(0) = Tape(blankChar, input);
+}
+
+Id::Id(StateIdx state, uint32_t tapeCount, char blankChar, vector<char> input)
+    : _tapeCount(tapeCount), _state(state),
+      _position(vector<int32_t>(tapeCount, 0)),
+      _tapes(tapeCount, Tape(blankChar, "")), _blankChar(blankChar) {
+    _tapes.at(0) = Tape(blankChar, std::move(input));
 }
 
 uint32_t Id::tapeCount() const { return _tapeCount; }
 
+char Id::blankChar() const { return _blankChar; }
+
 int32_t Id::position(uint32_t tape) const { return _position.at(tape); }
 
+void Id::position(uint32_t tape, int32_t pos) { _position.at(tape) = pos; }
+
 StateIdx Id::state() const { return _state; }
 void Id::state(StateIdx state) { _state = state; }
 
 vector<char> Id::get() const {
     vector<char> res;
     for (size_t i = 0; i < _tapeCount; ++i) {
-        res.push_back(this->get(i, _position[i]));
+        res.push_back(this->get(i));
     }
     return res;
 }
 
-char Id::get(uint32_t N, int32_t pos) const {
-    auto orig = _position.at(N);
-    size_t k = pos < orig ? -1 - (pos - orig) : pos - orig;
-    const auto &tape = pos < orig ? _tapeL[N] : _tapeGE[N];
-    if (tape.size() > k)
-        return tape[k];
-    return _blankChar;
-}
+char Id::get(uint32_t N, int32_t pos) const { return _tapes.at(N).get(pos); }
 
 void Id::put(const vector<TapeChar> &s) {
     for (size_t i = 0; i < _position.size() && i < s.size(); ++i) {
         if (s[i].type == TapeChar::Wildcard)
             continue;
-        char c = s[i].type == TapeChar::Blank ? _blankChar : s[i].c;
-        auto &tape = _tapeGE[i];
-        if (!tape.empty()) {
-            if (c == _blankChar && tape.size() == 1) {
-                tape.pop_front();
-            } else {
-                tape[0] = c;
-            }
-        } else if (c != _blankChar) {
-            tape.push_front(c);
-        }
+        put(i, s[i].type == TapeChar::Blank ? _blankChar : s[i].c);
     }
 }
 
 void Id::move(const vector<Dir> &dirs) {
-    for (size_t i = 0; i < dirs.size() && i < _position.size(); ++i) {
-        deque<char> *toPop = nullptr, *toPush = nullptr;
-        if (dirs[i] == L) {
-            toPop = &(_tapeL[i]);
-            toPush = &(_tapeGE[i]);
-            --_position[i];
-        } else if (dirs[i] == R) {
-            toPop = &(_tapeGE[i]);
-            toPush = &(_tapeL[i]);
-            ++_position[i];
-        }
-        if (toPop && toPush) {
-            if (!toPop->empty()) {
-                auto c = toPop->front();
-                if (c != _blankChar || !toPush->empty())
-                    toPush->push_front(c);
-                toPop->pop_front();
-            } else if (!toPush->empty()) {
-                toPush->push_front(_blankChar);
-            }
-        }
-    }
+    for (size_t i = 0; i < dirs.size() && i < _position.size(); ++i)
+        move(i, dirs[i]);
 }
 
 // Returns a smallest range [left, right) containing all non-blank symbols.
 // That left == right means there is no non-blank symbol on tape N.
 pair<int32_t, int32_t> Id::nonBlankRange(uint32_t N) const {
-    auto bounds = visibleRange(N);
-    while (bounds.first < bounds.second && get(N, bounds.first) == _blankChar)
-        ++bounds.first;
-    while (bounds.first < bounds.second &&
-           get(N, bounds.second - 1) == _blankChar)
-        --bounds.second;
-    return bounds;
+    return _tapes.at(N).nonBlank();
 }
 
 // Returns a smallest range [left, right) containing all non-blank positions
 // as well as the position under the tape head.
 // In all cases, right - left >= 1.
 pair<int32_t, int32_t> Id::visibleRange(uint32_t N) const {
-    int32_t orig = _position.at(N);
-    int32_t left = orig - _tapeL[N].size(), right = orig + _tapeGE[N].size();
-    if (right == orig)
-        ++right;
-    return {left, right};
+    const int32_t pos = _position.at(N);
+    const auto bounds = nonBlankRange(N);
+    if (bounds.first == bounds.second)
+        return {pos, pos + 1};
+    return {std::min(pos, bounds.first), std::max(pos + 1, bounds.second)};
 }
 
 string Id::slice(uint32_t N, int32_t lo, int32_t hi) const {
-    string res;
-    // TODO: maybe optimize this
-    while (lo < hi)
-        res.push_back(this->get(N, lo++));
-    return res;
+    return _tapes.at(N).slice(lo, hi);
 }
 
+// Copies the non-blank cells in one piece, with blanks added on the side
+// of the head.
 string Id::visibleSlice(uint32_t N) const {
+    const auto &tape = _tapes.at(N);
+    const auto cells = tape.nonBlank();
+    const int32_t pos = _position.at(N);
+    if (cells.first == cells.second)
+        return string(1, _blankChar);
+    const auto lo = std::min(pos, cells.first);
+    const auto hi = std::max(pos + 1, cells.second);
     string res;
-    res.append(_tapeL.at(N).crbegin(), _tapeL.at(N).crend());
-    res.append(_tapeGE.at(N).begin(), _tapeGE.at(N).end());
-    if (res.empty())
-        res.push_back(_blankChar);
+    res.reserve(hi - lo);
+    res.append(cells.first - lo, _blankChar);
+    res.append(tape.span(cells.first, cells.second));
+    res.append(hi - cells.second, _blankChar);
     return res;
 }
 
-string Id::contents(uint32_t N) const {
-    auto bounds = this->nonBlankRange(N);
-    return this->slice(N, bounds.first, bounds.second);
+string_view Id::contentsView(uint32_t N) const {
+    const auto &tape = _tapes.at(N);
+    const auto bounds = tape.nonBlank();
+    return tape.span(bounds.first, bounds.second);
+}
+
+string Id::contents(uint32_t N) const { return string(contentsView(N)); }
+
+void Id::contents(uint32_t N, int32_t first, vector<char> cells) {
+    _tapes.at(N) = Tape(_blankChar, first, std::move(cells));
+}
+
+size_t Id::tapeBytes() const {
+    size_t res = 0;
+    for (const auto &tape : _tapes)
+        res += tape.bytes();
+    return res;
+}
+
+HeadCounters::HeadCounters(const Id &id)
+    : low(id.tapeCount()), high(id.tapeCount()), travel(id.tapeCount()) {
+    for (uint32_t i = 0; i < id.tapeCount(); ++i)
+        low[i] = high[i] = id.position(i);
+}
+
+// Returns the index of the rule to apply in state cur when read(i) is the
+// symbol under head i, or -1 if the machine halts.
+template <class Read> int32_t Tm::_match(StateIdx cur, Read read) const {
+    if (cur >= _stateCount || _final[cur])
+        return -1;
+    if (_table) {
+        size_t key = 0;
+        for (uint32_t i = 0; i < _tapeCount; ++i) {
+            auto code = _symCode[(unsigned char)read(i)];
+            if (code < 0)
+                return -1;
+            key = key * _symCount + code;
+        }
+        return _table[cur * _stride + key];
+    }
+    const auto width = _matcher->width();
+    uint8_t small[64];
+    vector<uint8_t> large;
+    auto *tuple = small;
+    if (width > sizeof small) {
+        large.resize(width);
+        tuple = large.data();
+    }
+    for (uint32_t i = 0; i < _tapeCount; ++i)
+        tuple[i] = read(i);
+    std::fill(tuple + _tapeCount, tuple + width, 0);
+    return _matcher->match(cur, tuple);
+}
+
+int32_t Tm::match(StateIdx cur, const char *read) const {
+    return _match(cur, [read](uint32_t i) { return read[i]; });
+}
+
+int32_t Tm::match(const Id &id) const {
+    return _match(id.state(), [&id](uint32_t i) { return id.get(i); });
+}
+
+void Tm::matchAll(const Id &id, vector<uint32_t> &res) const {
+    const auto cur = id.state();
+    if (cur >= _stateCount || _final[cur])
+        return;
+    for (auto k = _ruleStart[cur]; k < _ruleStart[cur + 1]; ++k) {
+        const auto r = _ruleList[k];
+        const auto *get = &_get[r * _tapeCount];
+        uint32_t i = 0;
+        while (i < _tapeCount && (get[i] < 0 || get[i] == (uint8_t)id.get(i)))
+            ++i;
+        if (i == _tapeCount)
+            res.push_back(r);
+    }
+}
+
+void Tm::apply(Id &id, uint32_t r) const {
+    const auto *put = &_put[r * _tapeCount];
+    const auto *dirs = &_dirs[r * _tapeCount];
+    for (uint32_t i = 0; i < _tapeCount; ++i) {
+        if (put[i] >= 0)
+            id.put(i, (char)put[i]);
+        id.move(i, dirs[i]);
+    }
+    id.state(_dst[r]);
 }
 
 bool Tm::transition(Id &id) const {
-    auto cur = id.state();
-    if (_finalStates.find(cur) == _finalStates.end() && _rules.size() > cur) {
-        auto rules = _rules.at(cur);
-        auto get = id.get();
-        for (auto r : rules) {
-            if (get.size() != r.get.size())
-                continue;
-            bool matched = true;
-            for (size_t i = 0; i < r.get.size(); ++i) {
-                if (r.get[i].type != TapeChar::Wildcard &&
-                    r.get[i].c != get[i]) {
-                    matched = false;
+    auto r = match(id);
+    if (r < 0) {
+        // Halted!
+        return false;
+    }
+    apply(id, r);
+    return true;
+}
+
+// run() for a machine of NT tapes. The heads and tapes are held in arrays
+// of fixed size for the length of the run, and every loop over the tapes
+// has a constant trip count. With Count, the head counters are kept in
+// such arrays too and stored back into heads at the end.
+template <uint32_t NT, bool Count>
+uint64_t Tm::_runFixed(Id &id, uint64_t maxSteps, HeadCounters *heads) const {
+    std::array<Tape *, NT> tapes;
+    std::array<int32_t, NT> pos, low, high;
+    std::array<uint64_t, NT> travel;
+    for (uint32_t i = 0; i < NT; ++i) {
+        tapes[i] = &id._tapes[i];
+        pos[i] = id._position[i];
+        if constexpr (Count) {
+            low[i] = heads->low[i];
+            high[i] = heads->high[i];
+            travel[i] = heads->travel[i];
+        }
+    }
+    auto state = id._state;
+    // Stores to the tapes may alias any member, so they are read once here.
+    const auto *const symCode = _symCode;
+    const auto *const final = _final;
+    const auto *const table = _table;
+    const auto *const allPut = _put;
+    const auto *const allDirs = _dirs;
+    const auto *const dst = _dst;
+    const auto stateCount = _stateCount;
+    const size_t symCount = _symCount, stride = _stride;
+    uint64_t steps = 0;
+    for (; steps < maxSteps; ++steps) {
+        std::array<char, NT> read;
+        for (uint32_t i = 0; i < NT; ++i)
+            read[i] = tapes[i]->get(pos[i]);
+        int32_t r = -1;
+        if (!table) {
+            r = match(state, read.data());
+        } else if (state < stateCount && !final[state]) {
+            size_t key = 0;
+            for (uint32_t i = 0; i < NT; ++i) {
+                const auto code = symCode[(unsigned char)read[i]];
+                if (code < 0) {
+                    key = SIZE_MAX;
                     break;
                 }
+                key = key * symCount + code;
             }
-            if (matched) {
-                id.put(r.put);
-                id.move(r.dirs);
-                id.state(r.dst);
-                return true;
+            if (key != SIZE_MAX)
+                r = table[state * stride + key];
+        }
+        if (r < 0)
+            break;
+        const auto *put = &allPut[r * NT];
+        const auto *dirs = &allDirs[r * NT];
+        for (uint32_t i = 0; i < NT; ++i) {
+            if (put[i] >= 0)
+                tapes[i]->put(pos[i], (char)put[i]);
+            pos[i] += dirs[i] == R ? 1 : dirs[i] == L ? -1 : 0;
+            if constexpr (Count) {
+                travel[i] += dirs[i] != N;
+                low[i] = std::min(low[i], pos[i]);
+                high[i] = std::max(high[i], pos[i]);
             }
         }
+        state = dst[r];
     }
-    // Halted!
-    return false;
+    for (uint32_t i = 0; i < NT; ++i) {
+        id._position[i] = pos[i];
+        if constexpr (Count) {
+            heads->low[i] = low[i];
+            heads->high[i] = high[i];
+            heads->travel[i] = travel[i];
+        }
+    }
+    id._state = state;
+    return steps;
+}
+
+template <bool Count>
+uint64_t Tm::_run(Id &id, uint64_t maxSteps, HeadCounters *heads) const {
+    switch (_tapeCount) {
+    case 1:
+        return _runFixed<1, Count>(id, maxSteps, heads);
+    case 2:
+        return _runFixed<2, Count>(id, maxSteps, heads);
+    case 3:
+        return _runFixed<3, Count>(id, maxSteps, heads);
+    case 4:
+        return _runFixed<4, Count>(id, maxSteps, heads);
+    }
+    uint64_t steps = 0;
+    while (steps < maxSteps) {
+        auto r = match(id);
+        if (r < 0)
+            break;
+        apply(id, r);
+        if constexpr (Count) {
+            const auto *dirs = &_dirs[r * _tapeCount];
+            for (uint32_t i = 0; i < _tapeCount; ++i) {
+                const auto pos = id._position[i];
+                heads->travel[i] += dirs[i] != N;
+                heads->low[i] = std::min(heads->low[i], pos);
+                heads->high[i] = std::max(heads->high[i], pos);
+            }
+        }
+        ++steps;
+    }
+    return steps;
+}
+
+// Runs at most maxSteps transitions and returns the number executed, which
+// is less than maxSteps only if the machine has halted. Machines of up to
+// four tapes run on an engine specialised for their tape count.
+uint64_t Tm::run(Id &id, uint64_t maxSteps) const {
+    return _run<false>(id, maxSteps, nullptr);
+}
+
+uint64_t Tm::run(Id &id, uint64_t maxSteps, HeadCounters &heads) const {
+    return _run<true>(id, maxSteps, &heads);
 }
@@ -2,17 +2,21 @@
 #ifndef _FLA_TM_H
 #define _FLA_TM_H
 
+#include <algorithm>
+#include <array>
+#include <bitset>
 #include <cstdint>
 #include <deque>
 #include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <utility>
 #include <vector>
-using std::int32_t, std::optional, std::string, std::vector, std::deque,
-    std::unordered_set, std::unordered_map, std::pair;
+using std::int32_t, std::optional, std::string, std::vector,
+    std::unordered_set, std::unordered_map, std::pair, std::string_view;
 using StateIdx = uint32_t;
 using StateName = string;
 
@@ -26,17 +30,98 @@ struct TmError {
 
 enum Dir { L, R, N };
 
+// A set of symbols, one bit per byte value.
+class Alphabet {
+  private:
+    std::bitset<256> _bits;
+
+  public:
+    void insert(char c) { _bits.set((unsigned char)c); }
+    bool count(char c) const { return _bits.test((unsigned char)c); }
+    // The members in byte order.
+    string symbols() const;
+    // A member that other lacks, if any.
+    optional<char> firstOutside(const Alphabet &other) const;
+};
+
 struct TapeChar {
     enum { Char, Blank, Wildcard } type;
     char c;
 };
 
+// A tape kept in a single contiguous buffer, grown geometrically towards
+// whichever end is written past. Cell pos is stored at _buf[_origin + pos];
+// every cell outside the buffer is blank. Every non-blank cell also lies in
+// [_lo, _hi), which put() widens as it writes and nonBlank() narrows down
+// to the exact bounds, so that finding them again only looks at the cells
+// written since.
+class Tape {
+  private:
+    vector<char> _buf;
+    int32_t _origin;
+    char _blankChar;
+    mutable int32_t _lo, _hi;
+    void _grow(int32_t pos);
+
+  public:
+    Tape(char, string);
+    Tape(char, vector<char>);
+    // Holds cells from cell first on, which must be above INT32_MIN and
+    // leave first + cells.size() within int32_t.
+    Tape(char, int32_t first, vector<char> cells);
+    pair<int32_t, int32_t> extent() const;
+    // The smallest range [lo, hi) holding every non-blank cell; lo == hi
+    // when there is none.
+    pair<int32_t, int32_t> nonBlank() const;
+    // Bytes held by the buffer, which never shrinks.
+    size_t bytes() const { return _buf.capacity(); }
+    // Makes room in the buffer for cell pos.
+    void reserve(int32_t pos) {
+        const auto ext = extent();
+        if (pos < ext.first || pos >= ext.second)
+            _grow(pos);
+    }
+    // The buffer, for engines that run on it in place: cell pos is at
+    // data()[pos - extent().first]. Any cell may be written through it, so
+    // nonBlank() looks at the whole buffer next time.
+    char *data() {
+        const auto ext = extent();
+        _lo = ext.first;
+        _hi = ext.second;
+        return _buf.data();
+    }
+    // The cells [lo, hi), which must lie within extent(), in place.
+    string_view span(int32_t lo, int32_t hi) const {
+        return string_view(_buf.data() + _origin + lo, hi - lo);
+    }
+    string slice(int32_t, int32_t) const;
+    char get(int32_t pos) const {
+        size_t k = (size_t)(int64_t)pos + _origin;
+        return k < _buf.size() ? _buf[k] : _blankChar;
+    }
+    void put(int32_t pos, char c) {
+        size_t k = (size_t)(int64_t)pos + _origin;
+        if (k >= _buf.size()) {
+            if (c == _blankChar)
+                return;
+            _grow(pos);
+            k = (size_t)(int64_t)pos + _origin;
+        }
+        _buf[k] = c;
+        _lo = std::min(_lo, pos);
+        _hi = std::max(_hi, pos + 1);
+    }
+};
+
 class Id {
+    friend class Tm;
+    friend class JitMachine;
+
   private:
     uint32_t _tapeCount;
     StateIdx _state;
     vector<int32_t> _position;
-    vector<deque<char>> _tapeL, _tapeGE;
+    vector<Tape> _tapes;
     char _blankChar;
 
   public:
@@ -44,48 +129,79 @@ class Id {
     StateIdx state() const;
     void state(StateIdx);
     int32_t position(uint32_t) const;
+    void position(uint32_t, int32_t);
     uint32_t tapeCount() const;
+    char blankChar() const;
     //
     Id(StateIdx, uint32_t, char, string);
+    // Takes over input as the contents of tape 0, without copying it.
+    Id(StateIdx, uint32_t, char, vector<char> input);
     vector<char> get() const;
+    char get(uint32_t N) const { return _tapes[N].get(_position[N]); }
     char get(uint32_t, int32_t) const;
     string slice(uint32_t, int32_t, int32_t) const;
     string visibleSlice(uint32_t) const;
     pair<int32_t, int32_t> nonBlankRange(uint32_t) const;
     pair<int32_t, int32_t> visibleRange(uint32_t) const;
     void put(const vector<TapeChar> &);
+    void put(uint32_t N, char c) { _tapes[N].put(_position[N], c); }
     void move(const vector<Dir> &);
+    void move(uint32_t N, Dir dir) {
+        _position[N] += dir == R ? 1 : dir == L ? -1 : 0;
+    }
     string contents(uint32_t) const;
+    // Replaces tape N with cells, the first of them at cell first, as
+    // Tape(char, int32_t, vector<char>) does.
+    void contents(uint32_t N, int32_t first, vector<char> cells);
+    // The non-blank cells of tape N in place, valid until the tape changes.
+    string_view contentsView(uint32_t N) const;
+    // Bytes held by all tapes.
+    size_t tapeBytes() const;
 };
 
-template <class S> struct Rule {
-    S src, dst;
-    vector<TapeChar> get, put;
-    vector<Dir> dirs;
-    Rule(S src, S dst, vector<TapeChar> get, vector<TapeChar> put,
-         vector<Dir> dirs)
-        : src(src), dst(dst), get(get), put(put), dirs(dirs) {}
+// Counters Tm::run can keep on request, cheap enough to leave on: per
+// tape, the lowest and highest cell the head has visited and the number
+// of moves it has made.
+struct HeadCounters {
+    vector<int32_t> low, high;
+    vector<uint64_t> travel;
+    // Starts from the head positions of id.
+    explicit HeadCounters(const Id &id);
 };
 
 class Tm;
+class RuleMatcher;
 class TmBuilder {
   private:
     uint32_t _tapeCount;
-    unordered_set<StateName> _states, _finalStates;
-    optional<StateName> _initialState;
-    unordered_set<char> _inAlphabet, _tapeAlphabet;
-    vector<Rule<StateName>> _rules;
+    // States are numbered in the order of addState(), which the parser
+    // calls in #Q order. Names live in a deque so that the views _stateId
+    // is keyed on stay put as states are added.
+    std::deque<StateName> _stateNames;
+    unordered_map<string_view, StateIdx> _stateId;
+    vector<uint8_t> _final;
+    optional<StateIdx> _initialState;
+    Alphabet _inAlphabet, _tapeAlphabet;
+    // Rules in declaration order, laid out as in Tm: rule r owns the entries
+    // [r * _tapeCount, (r + 1) * _tapeCount) of _get, _put and _dirs, where
+    // symbols are stored as by _code().
+    vector<StateIdx> _src, _dst;
+    vector<int16_t> _get, _put;
+    vector<Dir> _dirs;
     optional<char> _blankChar;
     TmBuilder(uint32_t);
-    void _mustHaveState(const StateName &name) const;
+    StateIdx _mustHaveState(string_view name) const;
+    int16_t _code(const TapeChar &, const char *what) const;
 
   public:
     static TmBuilder withTapes(uint32_t);
     TmBuilder &addState(StateName);
     TmBuilder &addInputSymbol(char);
     TmBuilder &addTapeSymbol(char);
-    TmBuilder &addTransition(StateName srcState, std::vector<TapeChar> &get,
-                             StateName dstState, std::vector<TapeChar> &put,
+    TmBuilder &addTransition(string_view srcState,
+                             const vector<TapeChar> &get,
+                             string_view dstState,
+                             const vector<TapeChar> &put,
                              const vector<Dir> &dir);
     TmBuilder &makeInitial(StateName);
     TmBuilder &makeFinal(StateName);
@@ -97,22 +213,89 @@ class Tm {
     friend Tm TmBuilder::build() const;
 
   private:
-    uint32_t _tapeCount;
-    vector<string> _stateName;
-    unordered_map<StateName, StateIdx> _stateId;
-    unordered_set<StateIdx> _states, _finalStates;
+    // The compiled machine is a single image laid out as a .tmb file (see
+    // tm.cpp), shared between copies. Built machines own it on the heap;
+    // loaded ones usually point into a mapped file.
+    std::shared_ptr<const void> _owner;
+    string_view _image;
+    uint32_t _tapeCount, _stateCount, _ruleCount;
     StateIdx _initialState;
-    unordered_set<char> _inAlphabet, _tapeAlphabet;
-    vector<vector<Rule<StateIdx>>> _rules;
     char _blankChar;
+    uint32_t _symCount;
+    // Sections of the image.
+    // _inAlphabet[c] is 1 for input symbols; _symCode[c] is the dense code
+    // of tape symbol c, or -1.
+    const uint8_t *_inAlphabet;
+    const int16_t *_symCode;
+    const uint8_t *_final;
+    // State s is named _names[_nameStart[s], _nameStart[s + 1]).
+    const uint32_t *_nameStart;
+    const char *_names;
+    // Rules are numbered in declaration order; rule r owns the entries
+    // [r * _tapeCount, (r + 1) * _tapeCount) of _get, _put and _dirs.
+    // In _get and _put, -1 stands for a wildcard. The rules of state s are
+    // _ruleList[_ruleStart[s], _ruleStart[s + 1]).
+    const uint32_t *_ruleStart, *_ruleList;
+    const StateIdx *_dst;
+    const int16_t *_get, *_put;
+    const Dir *_dirs;
+    // _table[state * _stride + tuple] is the first rule matching the read
+    // tuple (base-_symCount number of symbol codes), or -1 to halt. Null
+    // when it would be too large; match() then runs _matcher over the rules
+    // of the state.
+    size_t _stride;
+    const int32_t *_table;
+    std::shared_ptr<const RuleMatcher> _matcher;
+    // The input alphabet as _inRangeCount byte ranges, holding the c with
+    // (uint8_t)(c - _inLow[k]) <= _inSpan[k], so that firstInvalid() can
+    // check 16 bytes at a time; 0 when it takes more than IN_RANGES.
+    static const uint32_t IN_RANGES = 4;
+    std::array<uint8_t, IN_RANGES> _inLow, _inSpan;
+    uint32_t _inRangeCount;
     Tm();
+    void _attach(std::shared_ptr<const void>, string_view);
+    template <class Read> int32_t _match(StateIdx, Read) const;
+    template <uint32_t NT, bool Count>
+    uint64_t _runFixed(Id &, uint64_t, HeadCounters *) const;
+    template <bool Count> uint64_t _run(Id &, uint64_t, HeadCounters *) const;
 
   public:
+    // Compiled images (.tmb files).
+    static bool isImage(string_view);
+    static Tm fromImage(std::shared_ptr<const void>, string_view);
+    string_view image() const;
+    // A hash of the image, identifying the machine.
+    uint64_t hash() const;
+
     const vector<StateIdx> finalStates() const;
+    uint32_t stateCount() const;
     string stateName(StateIdx) const;
+    StateIdx initialState() const;
     bool validate(char c) const;
-    bool validate(string input) const;
+    bool validate(const string &) const;
+    // The position of the first character of input outside the input
+    // alphabet, or string::npos.
+    size_t firstInvalid(string_view input) const;
+    bool isFinal(StateIdx) const;
+    uint32_t tapeCount() const;
+    // Compiled rules, each holding tapeCount() symbols and directions.
+    uint32_t ruleCount() const;
+    StateIdx ruleDst(uint32_t) const;
+    const int16_t *ruleGet(uint32_t) const;
+    const int16_t *rulePut(uint32_t) const;
+    const Dir *ruleDirs(uint32_t) const;
+    // The rules of a state, in the order they are tried.
+    pair<const uint32_t *, const uint32_t *> stateRules(StateIdx) const;
+    int32_t match(StateIdx, const char *) const;
+    int32_t match(const Id &) const;
+    // Every rule that applies to id, in declaration order, for machines run
+    // nondeterministically. Appended to res.
+    void matchAll(const Id &, vector<uint32_t> &res) const;
+    void apply(Id &, uint32_t) const;
     bool transition(Id &) const;
+    uint64_t run(Id &, uint64_t) const;
+    // Like run, updating heads with every step.
+    uint64_t run(Id &, uint64_t, HeadCounters &heads) const;
     char blankChar() const;
     Id initialId(string) const;
     // TODO: add some interface (visitor???) to export it as .tm file.
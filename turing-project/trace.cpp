@@ -0,0 +1,144 @@
+#include "trace.h"
+#include <algorithm>
+#include <charconv>
+
+// The buffer is handed to the stream once it grows past this.
+static const size_t CHUNK = 1 << 20;
+
+static void appendInt(string &out, int64_t v) {
+    char digits[24];
+    const auto end = std::to_chars(digits, digits + sizeof digits, v).ptr;
+    out.append(digits, end);
+}
+
+bool parseTraceFormat(const string &name, TraceWriter::Format &format) {
+    if (name == "human")
+        format = TraceWriter::Human;
+    else if (name == "compact")
+        format = TraceWriter::Compact;
+    else
+        return false;
+    return true;
+}
+
+TraceWriter::TraceWriter(const Tm &tm, std::ostream &out, Format format)
+    : _tm(tm), _out(out), _format(format), _started(false),
+      _views(tm.tapeCount()), _heads(tm.tapeCount()) {
+    _buf.reserve(CHUNK + CHUNK / 4);
+}
+
+TraceWriter::~TraceWriter() { flush(); }
+
+const string &TraceWriter::_stateName(StateIdx state) {
+    if (state >= _names.size())
+        _names.resize(state + 1);
+    if (_names[state].empty())
+        _names[state] = _tm.stateName(state);
+    return _names[state];
+}
+
+// Brings the view of tape N up to date with id. While the left end of the
+// visible range stays put, the columns of the cells already rendered do
+// not move: the cell the last step wrote and the head marks are patched in
+// place, and cells are only added or dropped at the right end.
+void TraceWriter::_render(TapeView &v, const Id &id, uint32_t N) {
+    const auto bounds = id.visibleRange(N);
+    if (!_started || bounds.first != v.first) {
+        v.first = v.last = bounds.first;
+        v.col.clear();
+        v.index.clear();
+        v.cells.clear();
+        v.heads.clear();
+    } else {
+        if (v.head >= v.first && v.head < v.last) {
+            const auto c = v.col[v.head - v.first];
+            v.cells[c] = id.get(N, v.head);
+            v.heads[c] = ' ';
+        }
+        if (bounds.second < v.last) {
+            const auto c = v.col[bounds.second - v.first];
+            v.col.resize(bounds.second - v.first);
+            v.index.resize(c);
+            v.cells.resize(c);
+            v.heads.resize(c);
+            v.last = bounds.second;
+        }
+    }
+    for (auto index = v.last; index < bounds.second; ++index) {
+        const auto c = v.index.size();
+        v.col.push_back(c);
+        appendInt(v.index, index < 0 ? -(int64_t)index : index);
+        const auto width = v.index.size() - c;
+        v.index.push_back(' ');
+        v.cells.push_back(id.get(N, index));
+        v.cells.append(width, ' ');
+        v.heads.append(width + 1, ' ');
+    }
+    v.last = bounds.second;
+    v.head = id.position(N);
+    v.heads[v.col[v.head - v.first]] = '^';
+}
+
+void TraceWriter::_writeHuman(uint64_t step, const Id &id) {
+    _buf.append("Step   : ");
+    appendInt(_buf, step);
+    _buf.push_back('\n');
+    for (uint32_t N = 0; N < _views.size(); ++N) {
+        auto &v = _views[N];
+        _render(v, id, N);
+        _buf.append("Index");
+        appendInt(_buf, N);
+        _buf.append(" : ");
+        _buf.append(v.index);
+        _buf.append("\nTape");
+        appendInt(_buf, N);
+        _buf.append("  : ");
+        _buf.append(v.cells);
+        _buf.append("\nHead");
+        appendInt(_buf, N);
+        _buf.append("  : ");
+        _buf.append(v.heads);
+        _buf.push_back('\n');
+    }
+    _buf.append("State  : ");
+    _buf.append(_stateName(id.state()));
+    _buf.append("\n---------------------------------------------\n");
+}
+
+void TraceWriter::_writeCompact(uint64_t step, const Id &id) {
+    appendInt(_buf, step);
+    _buf.push_back(' ');
+    appendInt(_buf, id.state());
+    for (uint32_t N = 0; N < _heads.size(); ++N) {
+        _buf.push_back(' ');
+        appendInt(_buf, id.position(N));
+    }
+    _buf.push_back(' ');
+    for (uint32_t N = 0; N < _heads.size(); ++N) {
+        if (!_started)
+            _heads[N] = id.position(N);
+        _buf.push_back(id.get(N, _heads[N]));
+        _heads[N] = id.position(N);
+    }
+    _buf.push_back('\n');
+}
+
+void TraceWriter::write(uint64_t step, const Id &id) {
+    if (_format == Human)
+        _writeHuman(step, id);
+    else
+        _writeCompact(step, id);
+    _started = true;
+    if (_buf.size() >= CHUNK)
+        _drain();
+}
+
+void TraceWriter::_drain() {
+    _out.write(_buf.data(), _buf.size());
+    _buf.clear();
+}
+
+void TraceWriter::flush() {
+    _drain();
+    _out.flush();
+}
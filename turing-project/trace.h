@@ -0,0 +1,51 @@
+// -*- mode: c++ -*- .
+#ifndef _FLA_TRACE_H
+#define _FLA_TRACE_H
+#include "tm.h"
+#include <ostream>
+
+// Writes the verbose trace of a run, one record per step, into a large
+// buffer that is handed to the stream in big chunks. write() must see every
+// step of the run in order, since only the cells the last step can have
+// changed are rendered again.
+//
+// Human is the block printed by turing -v. Compact is one line per step:
+//   <step> <state index> <head 0> ... <head N-1> <cells>
+// where cells holds, for each tape, the symbol now in the cell its head was
+// on before the step (at step 0, the symbol under the head).
+class TraceWriter {
+  public:
+    enum Format { Human, Compact };
+
+  private:
+    // The three rendered lines of a tape over the cells [first, last).
+    // Cell p starts at column col[p - first] of all of them.
+    struct TapeView {
+        int32_t first, last, head;
+        vector<uint32_t> col;
+        string index, cells, heads;
+    };
+    const Tm &_tm;
+    std::ostream &_out;
+    Format _format;
+    string _buf;
+    bool _started;
+    vector<TapeView> _views;
+    vector<int32_t> _heads;
+    vector<string> _names;
+    const string &_stateName(StateIdx);
+    void _render(TapeView &, const Id &, uint32_t);
+    void _writeHuman(uint64_t, const Id &);
+    void _writeCompact(uint64_t, const Id &);
+    void _drain();
+
+  public:
+    TraceWriter(const Tm &, std::ostream &, Format);
+    ~TraceWriter();
+    void write(uint64_t step, const Id &);
+    // Hands everything written so far to the stream and flushes it.
+    void flush();
+};
+
+bool parseTraceFormat(const string &, TraceWriter::Format &);
+#endif
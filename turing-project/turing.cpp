@@ -1,25 +1,128 @@
+#include "batch.h"
+#include "cycle.h"
+#include "debugger.h"
+#include "nondet.h"
 #include "parser.h"
+#include "profile.h"
+#include "record.h"
+#include "stats.h"
 #include "tm.h"
+#include "trace.h"
 #include "utils.h"
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <cstdlib>
+#include <fstream>
 #include <getopt.h>
 #include <iostream>
-#include <sstream>
+#include <thread>
+#include <unistd.h>
 
 static int print_help = 0;
 static int verbose_mode = 0;
+static int macro_mode = 0;
+static int compile_mode = 0;
+static int detect_cycles = 0;
+static int debug_mode = 0;
+static int profile_mode = 0;
+static int jit_mode = 0;
+static int nondeterministic = 0;
 static const string app_name = "turing";
-static string tm_path, input_str;
+static string tm_path, input_str, output_path;
+static optional<string> batch_path, record_path, replay_path, input_path;
+static optional<string> checkpoint_path, resume_path;
+static optional<uint64_t> replay_step, checkpoint_interval;
+static RunLimits limits;
+static unsigned threads = 1;
+static optional<TraceWriter::Format> trace_format;
+static optional<StatsFormat> stats_format;
+// Parse and build times of the machine, for --stats.
+static ParseTimes load_times;
+// Rows of each table in the --profile report.
+static const size_t profile_top = 20;
+// Exit status when the step budget or the time limit runs out.
+static const int limit_exit_code = 2;
+// Exit status when --detect-cycles finds that the machine does not halt.
+static const int cycle_exit_code = 3;
+// Exit status when no branch of a --nondeterministic run accepts.
+static const int reject_exit_code = 4;
+// Set by SIGTERM during a run with --checkpoint.
+static volatile std::sig_atomic_t terminated = 0;
+
+enum {
+    OPT_MAX_STEPS = 256,
+    OPT_TIMEOUT,
+    OPT_BATCH,
+    OPT_TRACE_FORMAT,
+    OPT_RECORD,
+    OPT_REPLAY,
+    OPT_AT,
+    OPT_CHECKPOINT_EVERY,
+    OPT_INPUT_FILE,
+    OPT_MAX_CONFIGS,
+    OPT_STATS,
+    OPT_CHECKPOINT,
+    OPT_RESUME
+};
 
 static const struct option long_options[] = {
     {"help", no_argument, &print_help, 1},
     {"verbose", no_argument, &verbose_mode, 1},
+    {"macro", no_argument, &macro_mode, 1},
+    {"compile", no_argument, &compile_mode, 1},
+    {"detect-cycles", no_argument, &detect_cycles, 1},
+    {"max-steps", required_argument, NULL, OPT_MAX_STEPS},
+    {"timeout", required_argument, NULL, OPT_TIMEOUT},
+    {"batch", required_argument, NULL, OPT_BATCH},
+    {"trace-format", required_argument, NULL, OPT_TRACE_FORMAT},
+    {"record", required_argument, NULL, OPT_RECORD},
+    {"replay", required_argument, NULL, OPT_REPLAY},
+    {"at", required_argument, NULL, OPT_AT},
+    {"debug", no_argument, &debug_mode, 1},
+    {"profile", no_argument, &profile_mode, 1},
+    {"jit", no_argument, &jit_mode, 1},
+    {"checkpoint-every", required_argument, NULL, OPT_CHECKPOINT_EVERY},
+    {"input-file", required_argument, NULL, OPT_INPUT_FILE},
+    {"nondeterministic", no_argument, &nondeterministic, 1},
+    {"max-configs", required_argument, NULL, OPT_MAX_CONFIGS},
+    {"stats", optional_argument, NULL, OPT_STATS},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"resume", required_argument, NULL, OPT_RESUME},
     {0, 0, 0, 0}};
 
 void print_usage(std::ostream &s) {
     s << "usage: " << app_name
-              << " [-v|--verbose] [-h|--help] <tm> <input>" << std::endl;
+      << " [-v|--verbose [--trace-format human|compact]] [-h|--help]"
+         " [--macro|--detect-cycles|--jit] [--max-steps N] [--timeout SECONDS]"
+         " [--record FILE] [--profile] <tm> <input>\n"
+      << "       " << app_name
+      << " [--detect-cycles|--jit] [--max-steps N] [--timeout SECONDS]"
+         " [--record FILE] [--profile] --input-file FILE|- <tm>\n"
+      << "       " << app_name
+      << " --stats[=json] [--max-steps N] [--timeout SECONDS]"
+         " <tm> <input>|--input-file FILE|-\n"
+      << "       " << app_name
+      << " [--macro|--detect-cycles|--jit] [--max-steps N] [--timeout SECONDS]"
+         " [-j N] --batch FILE|- <tm>\n"
+      << "       " << app_name
+      << " --nondeterministic [--max-steps N] [--max-configs N]"
+         " [--timeout SECONDS] [-j N] <tm> <input>|--input-file FILE|-\n"
+      << "       " << app_name
+      << " [--jit] [--max-steps N] [--timeout SECONDS]"
+         " --checkpoint FILE [--checkpoint-every N]"
+         " <tm> <input>|--input-file FILE|-\n"
+      << "       " << app_name
+      << " [--jit] [--max-steps N] [--timeout SECONDS]"
+         " [--checkpoint FILE [--checkpoint-every N]] --resume FILE <tm>\n"
+      << "       " << app_name << " --compile <tm> -o <out.tmb>\n"
+      << "       " << app_name
+      << " --replay FILE [--at N] [--trace-format human|compact] <tm>\n"
+      << "       " << app_name
+      << " --debug [--checkpoint-every N] [--max-steps N] <tm> <input>"
+      << std::endl;
 }
 
 void die(string msg, int code = 1) {
@@ -27,10 +130,19 @@ void die(string msg, int code = 1) {
     std::exit(code);
 }
 
+uint64_t parse_steps(const char *arg) {
+    char *end;
+    errno = 0;
+    const auto n = std::strtoull(arg, &end, 10);
+    if (errno || *end || !*arg || *arg == '-')
+        die(string("Invalid step count: ") + arg);
+    return n;
+}
+
 void parse_options(int argc, char **argv) {
     int c;
     do {
-        c = getopt_long(argc, argv, "hv", long_options, NULL);
+        c = getopt_long(argc, argv, "hvj:o:", long_options, NULL);
         switch (c) {
         case 0:
             break;
@@ -40,6 +152,72 @@ void parse_options(int argc, char **argv) {
         case 'v':
             verbose_mode = 1;
             break;
+        case OPT_MAX_STEPS:
+            limits.maxSteps = parse_steps(optarg);
+            break;
+        case OPT_TIMEOUT: {
+            char *end;
+            limits.timeout = std::strtod(optarg, &end);
+            if (*end || !*optarg || !(limits.timeout.value() >= 0))
+                die(string("Invalid timeout: ") + optarg);
+            break;
+        }
+        case 'j': {
+            char *end;
+            const auto n = std::strtol(optarg, &end, 10);
+            if (*end || !*optarg || n < 0 || n > 4096)
+                die(string("Invalid thread count: ") + optarg);
+            // -j 0 uses every hardware thread
+            threads = n ? n : std::max(std::thread::hardware_concurrency(), 1u);
+            break;
+        }
+        case OPT_BATCH:
+            batch_path = optarg;
+            break;
+        case OPT_TRACE_FORMAT: {
+            TraceWriter::Format format;
+            if (!parseTraceFormat(optarg, format))
+                die(string("Invalid trace format: ") + optarg);
+            trace_format = format;
+            break;
+        }
+        case OPT_RECORD:
+            record_path = optarg;
+            break;
+        case OPT_REPLAY:
+            replay_path = optarg;
+            break;
+        case OPT_AT:
+            replay_step = parse_steps(optarg);
+            break;
+        case OPT_CHECKPOINT_EVERY:
+            checkpoint_interval = parse_steps(optarg);
+            if (!checkpoint_interval.value())
+                die(string("Invalid step count: ") + optarg);
+            break;
+        case OPT_INPUT_FILE:
+            input_path = optarg;
+            break;
+        case OPT_MAX_CONFIGS:
+            limits.maxConfigs = parse_steps(optarg);
+            break;
+        case OPT_CHECKPOINT:
+            checkpoint_path = optarg;
+            break;
+        case OPT_RESUME:
+            resume_path = optarg;
+            break;
+        case OPT_STATS:
+            if (!optarg)
+                stats_format = StatsFormat::Human;
+            else if (string(optarg) == "json")
+                stats_format = StatsFormat::Json;
+            else
+                die(string("Invalid stats format: ") + optarg);
+            break;
+        case 'o':
+            output_path = optarg;
+            break;
         case '?':
             die(string("Unknown option: -") + argv[optind - 1]);
             break;
@@ -49,7 +227,103 @@ void parse_options(int argc, char **argv) {
         print_usage(std::cout);
         exit(0);
     }
-    if (optind + 2 != argc) {
+    if (trace_format && !verbose_mode && !replay_path)
+        die("--trace-format requires --verbose or --replay");
+    if (replay_step && !replay_path)
+        die("--at requires --replay");
+    if (record_path && (verbose_mode || macro_mode || detect_cycles ||
+                        batch_path || compile_mode || replay_path))
+        die("--record cannot be used with --verbose, --macro, "
+            "--detect-cycles, --batch, --compile or --replay");
+    if (profile_mode && (verbose_mode || macro_mode || detect_cycles ||
+                         batch_path || compile_mode || replay_path ||
+                         record_path))
+        die("--profile cannot be used with --verbose, --macro, "
+            "--detect-cycles, --batch, --compile, --replay or --record");
+    if (jit_mode && (verbose_mode || macro_mode || detect_cycles ||
+                     record_path || profile_mode || debug_mode))
+        die("--jit cannot be used with --verbose, --macro, --detect-cycles, "
+            "--record, --profile or --debug");
+    if (checkpoint_interval && !debug_mode && !checkpoint_path)
+        die("--checkpoint-every requires --debug or --checkpoint");
+    if ((checkpoint_path || resume_path) &&
+        (verbose_mode || macro_mode || detect_cycles || batch_path ||
+         compile_mode || replay_path || record_path || profile_mode ||
+         debug_mode || nondeterministic || stats_format))
+        die("--checkpoint and --resume cannot be used with --verbose, "
+            "--macro, --detect-cycles, --batch, --compile, --replay, "
+            "--record, --profile, --debug, --nondeterministic or --stats");
+    if (resume_path && input_path)
+        die("--resume cannot be used with --input-file");
+    if (debug_mode && (verbose_mode || macro_mode || detect_cycles ||
+                       batch_path || compile_mode || replay_path ||
+                       record_path || profile_mode || limits.timeout))
+        die("--debug cannot be used with --verbose, --macro, "
+            "--detect-cycles, --batch, --compile, --replay, --record, "
+            "--profile or --timeout");
+    if (input_path && (verbose_mode || macro_mode || debug_mode ||
+                       batch_path || compile_mode || replay_path))
+        die("--input-file cannot be used with --verbose, --macro, --debug, "
+            "--batch, --compile or --replay");
+    if (nondeterministic &&
+        (verbose_mode || macro_mode || detect_cycles || batch_path ||
+         compile_mode || replay_path || record_path || profile_mode ||
+         jit_mode || debug_mode))
+        die("--nondeterministic cannot be used with --verbose, --macro, "
+            "--detect-cycles, --batch, --compile, --replay, --record, "
+            "--profile, --jit or --debug");
+    if (stats_format &&
+        (verbose_mode || macro_mode || detect_cycles || batch_path ||
+         compile_mode || replay_path || record_path || profile_mode ||
+         jit_mode || debug_mode || nondeterministic))
+        die("--stats cannot be used with --verbose, --macro, "
+            "--detect-cycles, --batch, --compile, --replay, --record, "
+            "--profile, --jit, --debug or --nondeterministic");
+    if (limits.maxConfigs != UINT64_MAX && !nondeterministic)
+        die("--max-configs requires --nondeterministic");
+    limits.macro = macro_mode;
+    limits.detectCycles = detect_cycles;
+    if (macro_mode && detect_cycles)
+        die("--detect-cycles cannot be used with --macro");
+    if (compile_mode) {
+        if (output_path.empty())
+            die("--compile requires -o");
+        if (optind + 1 != argc) {
+            print_usage(std::cerr);
+            die(optind == argc ? "Expecting tm"
+                               : string("Extra option: ") + argv[optind + 1]);
+        }
+        tm_path = argv[optind];
+    } else if (!output_path.empty()) {
+        die("-o requires --compile");
+    } else if (replay_path) {
+        if (batch_path)
+            die("--replay cannot be used with --batch");
+        if (optind + 1 != argc) {
+            print_usage(std::cerr);
+            die(optind == argc ? "Expecting tm"
+                               : string("Extra option: ") + argv[optind + 1]);
+        }
+        tm_path = argv[optind];
+    } else if (batch_path) {
+        if (verbose_mode)
+            die("--verbose cannot be used with --batch");
+        if (optind + 1 != argc) {
+            print_usage(std::cerr);
+            die(optind == argc ? "Expecting tm"
+                               : string("Extra option: ") + argv[optind + 1]);
+        }
+        tm_path = argv[optind];
+    } else if (threads > 1 && !nondeterministic) {
+        die("-j requires --batch or --nondeterministic");
+    } else if (input_path || resume_path) {
+        if (optind + 1 != argc) {
+            print_usage(std::cerr);
+            die(optind == argc ? "Expecting tm"
+                               : string("Extra option: ") + argv[optind + 1]);
+        }
+        tm_path = argv[optind];
+    } else if (optind + 2 != argc) {
         print_usage(std::cerr);
         switch (argc - optind) {
         case 0:
@@ -68,49 +342,52 @@ void parse_options(int argc, char **argv) {
     }
 }
 
-void printId(int step, const Tm &tm, const Id &id) {
-    // TODO: alignment
-    std::cout << "Step   : " << step << std::endl;
-    for (size_t N = 0; N < id.tapeCount(); ++N) {
-        const auto bounds = id.visibleRange(N);
-        const auto curpos = id.position(N);
-        std::ostringstream indss, tapess, headss;
-        for (auto index = bounds.first; index < bounds.second; ++index) {
-            const auto indstr = std::to_string(index < 0 ? -index : index);
-            const auto chr = id.get(N, index);
-            const auto width = indstr.length();
-            indss << indstr << ' ';
-            tapess << chr << string(width, ' ');
-            headss << (index == curpos ? '^' : ' ') << string(width, ' ');
-        }
-        std::cout << "Index" << N << " : " << indss.str() << '\n';
-        std::cout << "Tape" << N << "  : " << tapess.str() << '\n';
-        std::cout << "Head" << N << "  : " << headss.str() << '\n';
-    }
-    std::cout << "State  : " << tm.stateName(id.state()) << '\n';
-    std::cout << "---------------------------------------------" << std::endl;
+// Reports a run stopped by --max-steps or --timeout before halting.
+void die_limit(const Tm &tm, StateIdx state, uint64_t step) {
+    std::cerr << (step >= limits.maxSteps ? "Step budget exhausted"
+                                          : "Time limit exceeded")
+              << "\nSteps   : " << step
+              << "\nState   : " << tm.stateName(state)
+              << "\nAccepted: " << (tm.isFinal(state) ? "yes" : "no")
+              << std::endl;
+    exit(limit_exit_code);
 }
 
-void run_tm() {
-    const auto res = readFile(tm_path);
+MappedFile map_file(const string &path) {
+    const auto res = mapFile(path);
     if (res.isL()) {
         switch (res.getL()) {
         case RF_NOTFOUND:
-            die(string("File not found: ") + tm_path);
+            die(string("File not found: ") + path);
             break;
         case RF_PERM:
-            die(string("Permission denied: ") + tm_path);
+            die(string("Permission denied: ") + path);
             break;
         case RF_OTHER:
-            die(string("Unknown error when reading ") + tm_path);
+            die(string("Unknown error when reading ") + path);
             break;
         }
     }
-    const auto content = res.getR();
-#ifdef DEBUG
-    // std::cout << "Tm file content:\n" << content << std::endl;
-#endif
-    const auto parseResult = parseTm(content);
+    return res.getR();
+}
+
+// Loads the machine from a .tm file or a compiled image.
+Tm load_tm() {
+    const auto file = map_file(tm_path);
+    if (Tm::isImage(file.text())) {
+        try {
+            // A compiled image is only checked; loading it counts as parsing.
+            const auto start = std::chrono::steady_clock::now();
+            auto tm = Tm::fromImage(file.owner(), file.text());
+            load_times.parse = std::chrono::duration<double>(
+                                   std::chrono::steady_clock::now() - start)
+                                   .count();
+            return tm;
+        } catch (TmError e) {
+            die(e.msg + ": " + tm_path);
+        }
+    }
+    const auto parseResult = parseTm(file.text(), &load_times);
     if (parseResult.isL()) {
         std::cerr << "syntax error" << std::endl;
         if (verbose_mode) {
@@ -119,51 +396,300 @@ void run_tm() {
         exit(1);
     }
 
-    // TODO: catch errors
-    const auto tm = parseResult.getR();
-    for (size_t i = 0; i < input_str.length(); ++i) {
-        if (!tm.validate(input_str[i])) {
-            if (verbose_mode) {
-                std::cerr << "Input: " << input_str << std::endl;
-                std::cerr << "==================== ERR ====================\n"
-                          << "error: '" << input_str[i]
-                          << "' was not declared in the set of input symbols\n"
-                          << "Input: " << input_str << '\n'
-                          << string(7 + i, ' ') << "^\n"
-                          << "==================== END ===================="
-                          << std::endl;
-                exit(1);
-            } else {
-                die("illegal input");
+    return parseResult.getR();
+}
+
+// Writes the compiled image through a temporary file, so that the input
+// may be overwritten while it is still mapped.
+void compile_tm(const Tm &tm) {
+    const auto image = tm.image();
+    const auto tmp = output_path + ".tmp";
+    std::ofstream out(tmp, std::ios::binary);
+    if (!out.write(image.data(), image.size()) || !out.flush() ||
+        std::rename(tmp.c_str(), output_path.c_str()) != 0) {
+        std::remove(tmp.c_str());
+        die(string("Cannot write ") + output_path);
+    }
+}
+
+// Reports a run found by --detect-cycles to repeat itself forever.
+void die_cycle(uint64_t length, uint64_t start) {
+    std::cerr << "does not halt: cycle of length " << length
+              << " entered at step " << start << std::endl;
+    exit(cycle_exit_code);
+}
+
+// Reads the --input-file onto tape 0 of the initial Id, checking each piece
+// as it arrives. The input ends at the end of the file or its first line.
+Id read_input(const Tm &tm) {
+    const auto &path = input_path.value();
+    size_t len = 0;
+    bool illegal = false;
+    vector<char> buf;
+    const auto err = readFile(path, buf, [&](string_view piece) {
+        auto k = tm.firstInvalid(piece);
+        if (k == string::npos)
+            k = piece.size();
+        else if (piece[k] != '\n')
+            illegal = true;
+        len += k;
+        // Tape cells are numbered by int32_t.
+        if (len > INT32_MAX)
+            illegal = true;
+        return illegal ? 0 : k;
+    });
+    if (err)
+        die((err == RF_NOTFOUND ? "File not found: "
+             : err == RF_PERM   ? "Permission denied: "
+                                : "Cannot read ") +
+            path);
+    if (illegal)
+        die(len > INT32_MAX ? "input too large" : "illegal input");
+    return Id(tm.initialState(), tm.tapeCount(), tm.blankChar(),
+              std::move(buf));
+}
+
+static void on_sigterm(int) { terminated = 1; }
+
+// Runs id, which has taken start steps so far, within the limits of the
+// whole run. A --checkpoint is written every --checkpoint-every steps, if
+// given, and on SIGTERM, which then ends the process.
+RunResult run_checkpointed(const Tm &tm, Id id, uint64_t start) {
+    auto budget = limits;
+    budget.maxSteps = limits.maxSteps - std::min(limits.maxSteps, start);
+    uint64_t steps = start, saved = start;
+    const auto save = [&](const Id &id) {
+        if (!checkpoint_path)
+            return;
+        try {
+            saveCheckpoint(tm, id, steps, checkpoint_path.value());
+        } catch (RecordError e) {
+            die(e.msg);
+        }
+        saved = steps;
+    };
+    if (checkpoint_path)
+        std::signal(SIGTERM, on_sigterm);
+    auto res = runSteps(
+        tm, std::move(id),
+        [&](Id &id, uint64_t n) {
+            uint64_t done = 0;
+            while (done < n) {
+                auto chunk = n - done;
+                if (checkpoint_interval && checkpoint_path)
+                    chunk = std::min(chunk, saved +
+                                                checkpoint_interval.value() -
+                                                steps);
+                const auto k = limits.jit ? limits.jit->run(id, chunk)
+                                          : tm.run(id, chunk);
+                done += k;
+                steps += k;
+                if (k < chunk)
+                    break;
+                if (checkpoint_interval &&
+                    steps - saved >= checkpoint_interval.value())
+                    save(id);
+                if (terminated) {
+                    save(id);
+                    std::cerr << "Terminated\nSteps   : " << steps
+                              << "\nCheckpoint: " << checkpoint_path.value()
+                              << std::endl;
+                    exit(128 + SIGTERM);
+                }
             }
+            return done;
+        },
+        budget);
+    res.steps += start;
+    return res;
+}
+
+// Prints the Id at step --at (by default, the last one) of a recording.
+void replay_tm(const Tm &tm) {
+    try {
+        const Replay replay(tm, map_file(replay_path.value()));
+        const auto step = replay_step.value_or(replay.steps());
+        if (step > replay.steps())
+            die("Recording has only " + std::to_string(replay.steps()) +
+                " steps");
+        TraceWriter trace(tm, std::cout,
+                          trace_format.value_or(TraceWriter::Human));
+        trace.write(step, replay.at(step));
+    } catch (RecordError e) {
+        die(e.msg + ": " + replay_path.value());
+    }
+}
+
+// Runs --nondeterministic, printing tape 0 of a branch that accepts.
+void search_tm(const Tm &tm, const Id &id) {
+    const auto res = searchAll(tm, id, limits, threads);
+    switch (res.outcome) {
+    case SearchResult::Accept:
+        std::cout << res.contents << std::endl;
+        break;
+    case SearchResult::Reject:
+        std::cerr << "No branch accepts\nDepth   : " << res.steps
+                  << "\nConfigs : " << res.configs << std::endl;
+        exit(reject_exit_code);
+    case SearchResult::Limit:
+        std::cerr << (res.steps == limits.maxSteps ? "Step budget exhausted"
+                      : res.configs > limits.maxConfigs
+                          ? "Configuration budget exhausted"
+                          : "Time limit exceeded")
+                  << "\nDepth   : " << res.steps
+                  << "\nConfigs : " << res.configs << std::endl;
+        exit(limit_exit_code);
+    }
+}
+
+void run_tm() {
+    // TODO: catch errors
+    const auto tm = load_tm();
+    if (compile_mode) {
+        compile_tm(tm);
+        return;
+    }
+    if (replay_path) {
+        replay_tm(tm);
+        return;
+    }
+    if (jit_mode) {
+        try {
+            limits.jit = std::make_shared<JitMachine>(tm);
+        } catch (JitError e) {
+            die(e.msg);
+        }
+    }
+    if (batch_path) {
+        if (batch_path.value() == "-") {
+            runBatch(tm, std::cin, std::cout, limits, threads);
+        } else {
+            std::ifstream in(batch_path.value());
+            if (!in)
+                die(string("Cannot open ") + batch_path.value());
+            runBatch(tm, in, std::cout, limits, threads);
+        }
+        return;
+    }
+    if (const auto i = tm.firstInvalid(input_str); i != string::npos) {
+        if (verbose_mode) {
+            std::cerr << "Input: " << input_str << std::endl;
+            std::cerr << "==================== ERR ====================\n"
+                      << "error: '" << input_str[i]
+                      << "' was not declared in the set of input symbols\n"
+                      << "Input: " << input_str << '\n'
+                      << string(7 + i, ' ') << "^\n"
+                      << "==================== END ===================="
+                      << std::endl;
+            exit(1);
+        } else {
+            die("illegal input");
         }
     }
-    if (verbose_mode) {
-        std::cout << "Input: " << input_str << '\n';
-        std::cout << "==================== RUN ===================="
-                  << std::endl;
+    if (debug_mode) {
+        runDebugger(tm, input_str, std::cin, std::cout,
+                    checkpoint_interval.value_or(1 << 16), limits.maxSteps,
+                    isatty(STDIN_FILENO));
+        return;
+    }
+    const auto initial_id = [&tm]() {
+        return input_path ? read_input(tm) : tm.initialId(input_str);
+    };
+    if (nondeterministic) {
+        search_tm(tm, initial_id());
+        return;
+    }
+    if (!verbose_mode) {
+        RunResult res;
+        optional<Profiler> profile;
+        optional<RunStats> stats;
+        if (record_path) {
+            try {
+                auto id = initial_id();
+                Recorder record(tm, record_path.value(), id);
+                res = runSteps(
+                    tm, std::move(id),
+                    [&record](Id &id, uint64_t n) { return record.run(id, n); },
+                    limits);
+                record.finish(res.outcome == RunResult::Halted);
+            } catch (RecordError e) {
+                die(e.msg);
+            }
+        } else if (profile_mode) {
+            auto id = initial_id();
+            profile.emplace(tm, id);
+            res = runSteps(
+                tm, std::move(id),
+                [&profile](Id &id, uint64_t n) { return profile->run(id, n); },
+                limits);
+        } else if (resume_path) {
+            uint64_t start;
+            try {
+                auto id =
+                    loadCheckpoint(tm, map_file(resume_path.value()), start);
+                res = run_checkpointed(tm, std::move(id), start);
+            } catch (RecordError e) {
+                die(e.msg + ": " + resume_path.value());
+            }
+        } else if (checkpoint_path) {
+            res = run_checkpointed(tm, initial_id(), 0);
+        } else if (stats_format) {
+            stats.emplace();
+            stats->parseSeconds = load_times.parse;
+            stats->buildSeconds = load_times.build;
+            res = runCounted(tm, initial_id(), limits, *stats);
+        } else if (input_path) {
+            res = runId(tm, read_input(tm), limits);
+        } else {
+            res = runInput(tm, input_str, limits);
+        }
+        if (res.outcome == RunResult::Halted)
+            std::cout << res.contents << std::endl;
+        if (profile)
+            profile->report(std::cerr, profile_top);
+        if (stats)
+            writeStats(std::cerr, *stats, stats_format.value());
+        if (res.outcome == RunResult::Limit)
+            die_limit(tm, res.state, res.steps);
+        if (res.outcome == RunResult::Cycle)
+            die_cycle(res.cycleLength, res.steps);
+        return;
     }
+    std::cout << "Input: " << input_str << '\n';
+    std::cout << "==================== RUN ====================" << std::endl;
+    const auto start = std::chrono::steady_clock::now();
+    const auto timedOut = [&start]() {
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        return limits.timeout && elapsed.count() >= limits.timeout.value();
+    };
     auto id = tm.initialId(input_str);
-    uint32_t step = 0;
+    optional<CycleDetector> cycles;
+    if (detect_cycles)
+        cycles.emplace(tm, id);
+    TraceWriter trace(tm, std::cout,
+                      trace_format.value_or(TraceWriter::Human));
+    uint64_t step = 0;
     while (1) {
-        if (verbose_mode) {
-            printId(step, tm, id);
+        trace.write(step, id);
+        if (cycles && cycles->found()) {
+            trace.flush();
+            die_cycle(cycles->cycleLength(), cycles->cycleStart());
         }
-        if (!tm.transition(id)) {
+        if (step == limits.maxSteps || timedOut())
+            break;
+        if (!(cycles ? cycles->step(id) : tm.transition(id))) {
             // Halt
             break;
         }
         ++step;
-    };
-
-    const auto contents = id.contents(0);
-    if (verbose_mode) {
-        std::cout << "Result: " << contents
-                  << "\n==================== END ===================="
-                  << std::endl;
-    } else {
-        std::cout << contents << std::endl;
     }
+    trace.flush();
+    if (tm.match(id) >= 0)
+        die_limit(tm, id.state(), step);
+    std::cout << "Result: " << id.contentsView(0)
+              << "\n==================== END ===================="
+              << std::endl;
 }
 
 #ifdef DEBUG
@@ -1,6 +1,10 @@
 #include "utils.h"
+#include <algorithm>
 #include <errno.h>
-#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <utility>
 #define BUFSIZE 65536
 
@@ -24,30 +28,98 @@ vector<string> split(string s, char delim) {
     return res;
 }
 
-Either<FileError, string> readFile(string path) {
-    std::ifstream file(path, std::ifstream::in);
-    if (!file) {
-        switch (errno) {
-        case EPERM:
-        case EACCES:
-            return Either<FileError, string>::inl(RF_PERM);
+static FileError fileError(int err) {
+    switch (err) {
+    case EPERM:
+    case EACCES:
+        return RF_PERM;
+    case ENOENT:
+        return RF_NOTFOUND;
+    default:
+        return RF_OTHER;
+    }
+}
+
+// Maps regular files; anything else (pipes, terminals, /dev/stdin) is read
+// into a single growing buffer.
+Either<FileError, MappedFile> mapFile(const string &path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return Either<FileError, MappedFile>::inl(fileError(errno));
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        const size_t len = st.st_size;
+        if (len == 0) {
+            close(fd);
+            return Either<FileError, MappedFile>::inr(MappedFile(nullptr, ""));
+        }
+        void *addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+            return Either<FileError, MappedFile>::inl(fileError(errno));
+        madvise(addr, len, MADV_SEQUENTIAL);
+        shared_ptr<const void> owner(
+            addr, [len](const void *p) { munmap(const_cast<void *>(p), len); });
+        return Either<FileError, MappedFile>::inr(
+            MappedFile(owner, string_view((const char *)addr, len)));
+    }
+    auto buf = std::make_shared<string>();
+    size_t len = 0;
+    for (;;) {
+        if (buf->size() - len < BUFSIZE)
+            buf->resize(std::max<size_t>(2 * buf->size(), BUFSIZE));
+        const auto n = read(fd, &(*buf)[len], buf->size() - len);
+        if (n == 0)
             break;
-        case ENOENT:
-            return Either<FileError, string>::inl(RF_NOTFOUND);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            const auto err = errno;
+            close(fd);
+            return Either<FileError, MappedFile>::inl(fileError(err));
+        }
+        len += n;
+    }
+    close(fd);
+    buf->resize(len);
+    return Either<FileError, MappedFile>::inr(
+        MappedFile(buf, string_view(*buf)));
+}
+
+std::optional<FileError>
+readFile(const string &path, vector<char> &buf,
+         const std::function<size_t(string_view)> &take) {
+    const int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return fileError(errno);
+    buf.clear();
+    struct stat st;
+    // One byte more than the file, so that its end is seen without growing.
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode))
+        buf.resize(st.st_size + 1);
+    size_t len = 0;
+    std::optional<FileError> res;
+    for (;;) {
+        if (len == buf.size())
+            buf.resize(std::max<size_t>(2 * buf.size(), BUFSIZE));
+        const auto n = read(fd, &buf[len], buf.size() - len);
+        if (n == 0)
             break;
-        default:
-            return Either<FileError, string>::inl(RF_OTHER);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            res = fileError(errno);
             break;
         }
+        const auto kept = take(string_view(&buf[len], n));
+        len += kept;
+        if (kept < (size_t)n)
+            break;
     }
-    string res;
-    char buf[BUFSIZE+1];
-    do {
-        file.read(buf, BUFSIZE);
-        buf[file.gcount()] = '\0';
-        res.append(buf);
-    } while (file);
-    return Either<FileError, string>::inr(std::move(res));
+    if (fd != STDIN_FILENO)
+        close(fd);
+    buf.resize(len);
+    return res;
 }
 
 Either<FileError, string> saveToFile(string contents, string path) {
@@ -4,10 +4,12 @@
 #include <cassert>
 #include <functional>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
-using std::string, std::shared_ptr, std::vector, std::tuple;
+using std::string, std::shared_ptr, std::vector, std::tuple, std::string_view;
 string replicate(string, size_t);
 vector<string> split(string, char);
 enum FileError { RF_NOTFOUND, RF_PERM, RF_OTHER };
@@ -45,6 +47,27 @@ template <class L, class R> class Either {
     }
     template <class T> Either<L, T> fmap(std::function<T(const R &)>) const;
 };
-Either<FileError, string> readFile(string);
+// The contents of a file, memory-mapped when possible. Copies share the
+// mapping, which is released with the last of them.
+class MappedFile {
+  private:
+    shared_ptr<const void> _owner;
+    string_view _text;
+    MappedFile(shared_ptr<const void> owner, string_view text)
+        : _owner(std::move(owner)), _text(text) {}
+
+  public:
+    string_view text() const { return _text; }
+    // Keeps the contents alive for as long as it is held.
+    shared_ptr<const void> owner() const { return _owner; }
+    friend Either<FileError, MappedFile> mapFile(const string &);
+};
+Either<FileError, MappedFile> mapFile(const string &);
+// Reads path ("-" for standard input) into buf, sized up front when the
+// file size is known, passing each piece to take as it arrives. take
+// returns how many bytes of the piece to keep; keeping fewer ends the read.
+std::optional<FileError>
+readFile(const string &path, vector<char> &buf,
+         const std::function<size_t(string_view)> &take);
 Either<FileError, string> saveToFile(string, string);
 #endif